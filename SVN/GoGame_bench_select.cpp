@@ -0,0 +1,172 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <vector>
+
+#include "GoGame_mcts.h"
+
+using namespace std;
+
+#define NODES               4096 // The nodes of the tree, so it does not fit in the L1 cache
+#define ROUNDS              200  // The selections of every node timed
+
+/**
+ * Measures the time.
+ * @param wcTime The time measured on world clock
+ * @param cpuTime The time measured on CPU
+ */
+void timing(double *wcTime, double *cpuTime) {
+    struct timeval tp;
+    struct rusage ruse;
+
+    gettimeofday(&tp, NULL);
+    *wcTime = (double)(tp.tv_sec + tp.tv_usec / 1000000.0);
+
+    getrusage(RUSAGE_SELF, &ruse);
+    *cpuTime = (double)(ruse.ru_utime.tv_sec + ruse.ru_utime.tv_usec / 1000000.0);
+}
+
+/**
+ * Fills a tree with nodes of move_num moves, with scores as a search leaves
+ * them: some moves never tried, some with AMAF scores only, the others with
+ * games of their own.
+ */
+void fill(Tree &tree, int move_num) {
+    vector<int> moves(move_num);
+    for (int j = 0; j < move_num; ++j)
+        moves[j] = j;
+
+    for (int i = 0; i < NODES; ++i) {
+        uint32_t node = i == 0 ? tree.root() : tree.add_node();
+        tree.expand(node, &moves[0], move_num);
+
+        float games = 0;
+        for (int j = 0; j < move_num; ++j) {
+            uint32_t e = tree.nodes[node].first_edge + j;
+            int kind = rand() % 4;
+            float g = kind == 0 ? 0 : rand() % 1000;
+            float ag = kind == 1 ? 0 : rand() % 5000;
+            tree.edges.games[e] = g;
+            tree.edges.wins[e] = g * (rand() % 1001) / 1000;
+            tree.edges.amaf_games[e] = ag;
+            tree.edges.amaf_wins[e] = ag * (rand() % 1001) / 1000;
+            games += g;
+        }
+        tree.nodes[node].total_game = games;
+    }
+}
+
+/**
+ * Times the selection at every node of a tree, ROUNDS times over: the choice
+ * among the open moves only, their lowest prior and the log of the games of
+ * the node given.
+ * @param simd True for Tree::best_ucb, false for Tree::best_ucb_scalar.
+ * @returns The time of one selection, in nanoseconds.
+ */
+double time_best_ucb(const Tree &tree, bool simd, const float *least, const float *c,
+                     long *checksum) {
+    double start, end, cpu;
+    timing(&start, &cpu);
+
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (int i = 0; i < NODES; ++i) {
+            const Node &n = tree.nodes[i];
+            bool maximize = (r + i) & 1;
+            *checksum += simd ? tree.best_ucb(n.first_edge, n.edge_num, least[2 * i + maximize],
+                                              c[i], maximize)
+                              : tree.best_ucb_scalar(n.first_edge, n.edge_num,
+                                                     least[2 * i + maximize], c[i], maximize);
+        }
+    }
+
+    timing(&end, &cpu);
+    return (end - start) * 1e9 / ((double)ROUNDS * NODES);
+}
+
+/**
+ * Times Tree::select at every node of a tree, ROUNDS times over.
+ * @returns The time of one selection, in nanoseconds.
+ */
+double time_select(const Tree &tree, long *checksum) {
+    double start, end, cpu;
+    timing(&start, &cpu);
+
+    for (int r = 0; r < ROUNDS; ++r)
+        for (int i = 0; i < NODES; ++i)
+            *checksum += tree.select(i, (r + i) & 1);
+
+    timing(&end, &cpu);
+    return (end - start) * 1e9 / ((double)ROUNDS * NODES);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <moves per node>" << endl;
+        return -1;
+    }
+
+    int move_num = atoi(argv[1]);
+    if (move_num < 1 || move_num >= AMAF_POINTS) {
+        cout << "The moves per node must be in [1, " << AMAF_POINTS << ")" << endl;
+        return -1;
+    }
+
+    srand(1);
+    Tree tree;
+    fill(tree, move_num);
+
+    // Both choose the same moves, with and without widening and RAVE
+    int mismatches = 0;
+    for (int rave = 0; rave < 2; ++rave) {
+        tree.rave_equiv = rave ? RAVE_EQUIV : 0;
+        for (int widen = 0; widen < 2; ++widen) {
+            tree.widen_base = widen ? WIDEN_BASE : 0;
+            for (int i = 0; i < NODES; ++i) {
+                const Node &n = tree.nodes[i];
+                for (int maximize = 0; maximize < 2; ++maximize) {
+                    float least = tree.least_prior(n.first_edge, n.edge_num, n.total_game,
+                                                   maximize);
+                    float c = UCB_Z * log(n.total_game > 1 ? n.total_game : 1);
+                    if (tree.best_ucb(n.first_edge, n.edge_num, least, c, maximize) !=
+                        tree.best_ucb_scalar(n.first_edge, n.edge_num, least, c, maximize))
+                        mismatches++;
+                }
+            }
+        }
+    }
+    tree.rave_equiv = RAVE_EQUIV;
+    tree.widen_base = WIDEN_BASE;
+
+    vector<float> least(2 * NODES), c(NODES);
+    for (int i = 0; i < NODES; ++i) {
+        const Node &n = tree.nodes[i];
+        for (int maximize = 0; maximize < 2; ++maximize)
+            least[2 * i + maximize] = tree.least_prior(n.first_edge, n.edge_num, n.total_game,
+                                                       maximize);
+        c[i] = UCB_Z * log(n.total_game > 1 ? n.total_game : 1);
+    }
+
+    long checksum = 0;
+    double scalar = time_best_ucb(tree, false, &least[0], &c[0], &checksum);
+    double simd = time_best_ucb(tree, true, &least[0], &c[0], &checksum);
+    double select = time_select(tree, &checksum);
+
+#if defined(__AVX2__)
+    const char *kernel = "AVX2";
+#elif defined(__SSE2__)
+    const char *kernel = "SSE2";
+#else
+    const char *kernel = "scalar";
+#endif
+    cout << "Moves per node: " << move_num << endl;
+    cout << "Selections that differ: " << mismatches << endl;
+    cout << "Scalar: " << scalar << " ns per node" << endl;
+    cout << kernel << ": " << simd << " ns per node (" << scalar / simd << "x)" << endl;
+    cout << "Tree::select, widening included: " << select << " ns per node" << endl;
+    cout << "Checksum: " << checksum << endl;
+
+    return mismatches != 0;
+}
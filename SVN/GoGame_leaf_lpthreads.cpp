@@ -0,0 +1,661 @@
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <vector>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+
+#include "GoGame_mcts.h"
+#include "GoGame_playout.h"
+
+using namespace std;
+
+#define VISUAL              0   // For visualizing the game
+#define LOG                 1   // For printing the average time
+#define LOG_TREE            1   // For printing the memory of the trees at every move
+
+#define USE_TIME_ROUND      1   // 1 = Use time; 0 = Use iterations
+#define TIME_PER_ROUND      0.5   // In seconds
+#define TIME_MANAGER        0   // 1 = time_round is the main time of each player for the game (TimeManager)
+#define BYO_YOMI            0.0 // ... then the time of every move (0 = sudden death)
+
+#define USE_TIME_SIM        1   // 1 = Use time; 0 = Use iterations
+#define TIME_PER_SIM        0.05 // In seconds
+#define EARLY_STOP          0   // 1 = A search stops once the games left cannot change its move
+
+#define LEAF_PIPELINE       2   // The leaves simulated at once by the workers
+#define LEAF_SPIN           64  // The empty passes of a worker over the leaves before it sleeps
+
+
+/**
+ * Measures the time.
+ * @param wcTime The time measured on world clock
+ * @param cpuTime The time measured on CPU
+ */
+void timing(double *wcTime, double *cpuTime) {
+    struct timeval tp;
+    struct rusage ruse;
+
+    gettimeofday(&tp, NULL);
+    *wcTime = (double)(tp.tv_sec + tp.tv_usec / 1000000.0);
+
+    getrusage(RUSAGE_SELF, &ruse);
+    *cpuTime = (double)(ruse.ru_utime.tv_sec + ruse.ru_utime.tv_usec / 1000000.0);
+}
+
+/**
+ * Measures the world clock only, without the system call of timing: for the
+ * checks made at every game of a leaf.
+ * @returns The time in seconds, from an arbitrary point.
+ */
+double wall_clock() {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (double)(tp.tv_sec + tp.tv_nsec / 1000000000.0);
+}
+
+/**
+ * Lists the moves from current state: the pass when the player cannot put a
+ * stone, else every legal point, the ones far from the edge first.
+ * @param s Current state.
+ * @param moves The points where to put a stone (-1 for the pass), returned by
+ * side effect.
+ * @returns The number of moves.
+ */
+template <int N>
+int get_next_moves(Position<N> *s, int *moves) {
+    // If pass move, then the next move is only the "pass move"
+    if (s->is_pass()) {
+        moves[0] = -1;
+        return 1;
+    }
+
+    // The points from the 4th line inwards first, then the 3rd, 2nd and 1st
+    // lines: a cheap prior, as the selection opens the first moves of a node
+    // first until they have AMAF scores (see Tree::prior)
+    static const Bitboard<N> rings[3] = {inner_points<N>(3), inner_points<N>(2), inner_points<N>(1)};
+
+    int move_num = 0;
+    Bitboard<N> legal = s->legal_moves();
+    for (int i = 0; i <= 3; ++i) {
+        Bitboard<N> ring = i < 3 ? legal & rings[i] : legal;
+        legal = legal - ring;
+        while (ring.any()) {
+            int p = ring.first();
+            ring.reset(p);
+            moves[move_num++] = p;
+        }
+    }
+    return move_num;
+}
+
+/**
+ * Plays a move given by get_next_moves.
+ * @param s The current state.
+ * @param move The point where to put the stone, -1 for the pass.
+ * @param undo When given, records the move to take it back.
+ */
+template <int N>
+void play_move(Position<N> *s, int move, Undo *undo) {
+    if (move == -1)
+        s->pass_move(undo);
+    else
+        s->play(move, undo);
+}
+
+/**
+ * This is a random player.
+ * @param s The current state.
+ */
+template <int N>
+void random_play(Position<N> *s) {
+    if (!s->is_pass()) {
+        Bitboard<N> moves = s->legal_moves();
+        int p = moves.nth(rand() % moves.count());
+        s->make_move(Position<N>::row(p), Position<N>::col(p));
+    } else {
+        s->pass_move();
+    }
+}
+
+/**
+ * This is for manual play (playing against a human).
+ * @param s The current state.
+ */
+template <int N>
+void manual_play(Position<N> *s) {
+    if (!s->is_pass()) {
+        int x, y;
+        do {
+            cin >> x >> y;
+        } while (s->make_move(x, y) == -1);
+    } else {
+        s->pass_move();
+    }
+}
+
+/* Total number of games, rounds and steps played */
+unsigned long total_num_games = 0;
+unsigned long total_num_rounds = 0;
+unsigned long total_num_steps = 0;
+
+/* The most memory taken by the trees of the process at once, in bytes: the
+   ones of a move, and the ones the other player kept from its last move */
+unsigned long peak_tree_bytes = 0;
+unsigned long player_tree_bytes[2] = {0, 0};
+
+/* The clocks of the players at the end of the game, see TIME_MANAGER */
+double main_time_left[2] = {0, 0};
+int moves_over_time = 0;
+
+/* The seed of the simulations; every thread draws from its own generator */
+uint64_t random_seed = 0;
+
+/**
+ * A leaf of the tree whose simulations are played by the workers. The main
+ * thread fills it and opens it; the workers claim its games one at a time
+ * and add up the results with atomic counters, without locks.
+ */
+template <int N>
+struct Leaf {
+    Position<N> start;          // The state of the leaf
+    int player;                 // The player at the root of the search
+    float playout_num;          // The games (or the time) of the leaf
+    Path visited;               // The edges from the root, for the main thread
+
+    std::atomic<bool> open;     // The workers may claim games
+    std::atomic<int> active;    // The workers looking at the leaf
+    std::atomic<int> claimed;   // The games handed out
+    std::atomic<double> begin;  // When the first game was claimed, 0 before
+    std::atomic<int> games;     // The games played
+    std::atomic<int> half_wins; // Two per win of the player, one per draw
+    std::atomic<unsigned long> steps;
+
+    /* Whether the caller may play one more game of the leaf */
+    bool claim() {
+#if USE_TIME_SIM
+        double now = wall_clock(), zero = 0;
+        begin.compare_exchange_strong(zero, now);
+        return now - begin.load() < playout_num;
+#else
+        return claimed.fetch_add(1) < playout_num;
+#endif
+    }
+
+    /* Whether all the games of the leaf are handed out */
+    bool claimed_all() const {
+#if USE_TIME_SIM
+        return begin.load() != 0 && wall_clock() - begin.load() >= playout_num;
+#else
+        return claimed.load() >= playout_num;
+#endif
+    }
+
+    /* Plays one game of the leaf */
+    void play(Playout<N> &playout, Random &rng) {
+        unsigned long leaf_steps = 0;
+        int winner = playout.run(start, rng, &leaf_steps);
+        steps.fetch_add(leaf_steps);
+        half_wins.fetch_add(winner == player ? 2 : (winner == 0 ? 1 : 0));
+        games.fetch_add(1);
+    }
+};
+
+/**
+ * The leaves in flight, in a ring, and the workers that play their games.
+ * The workers live as long as the game: they look for an open leaf, the
+ * oldest first, without locks, and yield when there is none. After
+ * LEAF_SPIN passes without a game they sleep until the main thread opens a
+ * leaf, so they leave the core to it while it selects or plays a move.
+ */
+template <int N>
+struct LeafPool {
+    Leaf<N> leaves[LEAF_PIPELINE];
+    std::atomic<int> oldest;    // The leaf the main thread waits for
+    std::atomic<bool> stop;
+    std::atomic<int> sleeping;  // The workers waiting for work
+    pthread_mutex_t sleep_mutex;
+    pthread_cond_t work;
+
+    /* Whether a leaf has games to hand out */
+    bool has_work() const {
+        for (int k = 0; k < LEAF_PIPELINE; ++k)
+            if (leaves[k].open.load() && !leaves[k].claimed_all())
+                return true;
+        return false;
+    }
+
+    /* Wakes the sleeping workers, after a leaf is opened or on stop; the
+       call costs nothing while they are all awake */
+    void wake() {
+        if (sleeping.load() == 0)
+            return;
+        pthread_mutex_lock(&sleep_mutex);
+        pthread_cond_broadcast(&work);
+        pthread_mutex_unlock(&sleep_mutex);
+    }
+
+    /* Sleeps until a leaf has games to hand out, or until stop */
+    void sleep() {
+        pthread_mutex_lock(&sleep_mutex);
+        sleeping.fetch_add(1);
+        while (!stop.load() && !has_work())
+            pthread_cond_wait(&work, &sleep_mutex);
+        sleeping.fetch_sub(1);
+        pthread_mutex_unlock(&sleep_mutex);
+    }
+};
+
+template <int N>
+struct LeafWorker {
+    LeafPool<N> *pool;
+    int threadIndex;
+};
+
+/**
+ * The loop of a worker.
+ */
+template <int N>
+void *leaf_worker(void *args) {
+    LeafWorker<N> *w = (LeafWorker<N> *)args;
+    LeafPool<N> *pool = w->pool;
+    Random rng(random_seed, w->threadIndex);
+    Playout<N> playout;
+    int empty = 0;  // The passes over the leaves without a game
+
+    while (!pool->stop.load()) {
+        bool played = false;
+        int oldest = pool->oldest.load();
+
+        for (int k = 0; k < LEAF_PIPELINE && !played; ++k) {
+            Leaf<N> &leaf = pool->leaves[(oldest + k) % LEAF_PIPELINE];
+
+            // The main thread closes the leaf, then waits for active to be
+            // back to 0 before reading the results or reusing it
+            leaf.active.fetch_add(1);
+            if (leaf.open.load() && leaf.claim()) {
+                leaf.play(playout, rng);
+                played = true;
+            }
+            leaf.active.fetch_sub(1);
+        }
+
+        if (played) {
+            empty = 0;
+        } else if (++empty < LEAF_SPIN) {
+            sched_yield();
+        } else {
+            pool->sleep();
+            empty = 0;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * This is MCTS play with leaf parallelization: the main thread walks the
+ * tree and the workers play the simulations of the leaves it reaches. Up to
+ * LEAF_PIPELINE leaves are in flight, so the main thread selects the next
+ * leaf (with virtual losses on the paths still running) while the workers
+ * play the games of the current one, and helps with the oldest leaf while
+ * it waits for it.
+ * @param s The current state.
+ * @param iters The number of leaves (or the time) of the move.
+ * @param playout_num The number of simulations (or their time) of a leaf.
+ * @param tree The tree of the player, kept for its next move.
+ * @param pool The leaves shared with the workers.
+ * @returns A new state after choosing a move.
+ */
+template <int N>
+Position<N> *mcts_play(Position<N> *s, float iters, float playout_num, Tree &tree,
+                       LeafPool<N> &pool, int thread_num) {
+    int my_player = s->player;
+
+    // The player cannot put a stone. Pass move!
+    if (s->is_pass()) {
+        s->pass_move();
+        return s;
+    }
+
+    // The tree of this search, rooted at the current state: what the tree of
+    // the previous move collected under it, else an empty tree. The tree is
+    // pruned here only, when no leaf is in flight
+    int root_moves[Position<N>::POINTS];
+    int root_move_num = get_next_moves(s, root_moves);
+    tree.advance(s->key, root_moves, root_move_num);
+    if (tree.full())
+        tree.prune();
+
+    Position<N> &t = *s;  // Walks down the tree and back up
+    static vector<Undo> path;  // The moves that t made from the root
+    static Random rng(random_seed, thread_num);  // The workers take 0..thread_num-1
+    static Playout<N> playout;  // For the games the main thread helps with
+
+    int first = pool.oldest.load();  // The ring of the leaves in flight
+    int in_flight = 0;
+    bool searching = true;
+#if EARLY_STOP
+    double played = 0;  // The games of this search
+#endif
+
+#if USE_TIME_ROUND
+    double time1_round, time2_round, time_cpu;
+    timing(&time1_round, &time_cpu);
+#else
+    int leaves = 0;
+#endif
+
+    while (searching || in_flight > 0) {
+        // Selection of the next leaves, while the workers play the others
+        while (searching && in_flight < LEAF_PIPELINE) {
+            Leaf<N> &leaf = pool.leaves[(first + in_flight) % LEAF_PIPELINE];
+            total_num_rounds++;
+
+            // Selection, down to a node that is not in the tree yet (or to the
+            // longest path, around a cycle of repeated positions)
+            leaf.visited.clear();
+            uint32_t node = tree.root();
+            while (!t.game_over() && !leaf.visited.full()) {
+                // List the moves the first time the node is reached
+                if (!tree.expanded(node)) {
+                    int moves[Position<N>::POINTS];
+                    int move_num = get_next_moves(&t, moves);
+                    if (!tree.expand(node, moves, move_num))
+                        break;  // The tree is full: simulate from here
+                }
+
+                // The best open move by UCB (FPU for the ones never tried)
+                uint32_t e = tree.select(node, t.player == my_player);
+                leaf.visited.push_back(e);
+                path.push_back(Undo());
+                play_move(&t, tree.edges.move[e], &path.back());
+
+                if (tree.edges.child[e] == Tree::NONE) {
+                    // Explore new state (or join its node when it is in the tree)
+                    tree.add_child(e, t.key, leaf.visited);
+                    break;
+                }
+                node = tree.edges.child[e];
+            }
+
+            if (t.game_over()) {
+                // 't' is a final state, just update the scores
+                double total_g = playout_num, total_w = 0;
+                if (t.who_win() == my_player)
+                    total_w = playout_num;
+                else if (t.who_win() == 0)
+                    total_w = playout_num / 2.0;
+                tree.update(leaf.visited, total_g, total_w);
+#if EARLY_STOP
+                played += total_g;
+#endif
+            } else {
+                // Hand the leaf to the workers
+                leaf.start = t;
+                leaf.player = my_player;
+                leaf.playout_num = playout_num;
+                leaf.claimed.store(0);
+                leaf.begin.store(0);
+                leaf.games.store(0);
+                leaf.half_wins.store(0);
+                leaf.steps.store(0);
+                leaf.open.store(true);
+                pool.wake();
+                tree.virtual_loss(leaf.visited, VIRTUAL_LOSS);
+                in_flight++;
+            }
+
+            // Go back up to the root
+            while (!path.empty()) {
+                t.unmake_move(path.back());
+                path.pop_back();
+            }
+
+#if USE_TIME_ROUND
+            timing(&time2_round, &time_cpu);
+            searching = time2_round - time1_round < iters;
+#else
+            searching = ++leaves < iters;
+#endif
+        }
+
+        if (in_flight == 0)
+            continue;
+
+        // Back propagate the result of the oldest leaf once its games are
+        // played, helping the workers meanwhile
+        Leaf<N> &leaf = pool.leaves[first % LEAF_PIPELINE];
+        while (!leaf.claimed_all()) {
+            if (leaf.claim())
+                leaf.play(playout, rng);
+        }
+        leaf.open.store(false);
+        while (leaf.active.load() != 0)
+            sched_yield();
+
+        tree.virtual_loss(leaf.visited, -VIRTUAL_LOSS);
+        tree.update(leaf.visited, leaf.games.load(), leaf.half_wins.load() / 2.0);
+        total_num_games += leaf.games.load();
+        total_num_steps += leaf.steps.load();
+
+        first++;
+        pool.oldest.store(first % LEAF_PIPELINE);
+        in_flight--;
+
+#if EARLY_STOP
+        // Select no more leaves once the games left cannot change the move
+        // (the ones in flight are still played out)
+        played += leaf.games.load();
+        if (searching) {
+#if USE_TIME_ROUND
+            timing(&time2_round, &time_cpu);
+            double done = (time2_round - time1_round) / iters;
+#else
+            double done = leaves / iters;
+#endif
+            if (tree.decided(played, done, true, in_flight * VIRTUAL_LOSS) >= 0)
+                searching = false;
+        }
+#endif
+    }
+
+    // The memory of the tree of the move
+    unsigned long tree_bytes = tree.bytes();
+    player_tree_bytes[my_player == 1 ? 0 : 1] = tree_bytes;
+    if (peak_tree_bytes < player_tree_bytes[0] + player_tree_bytes[1])
+        peak_tree_bytes = player_tree_bytes[0] + player_tree_bytes[1];
+#if LOG_TREE
+    cout << "Tree memory (MB): " << tree_bytes / 1048576.0 << endl;
+#endif
+
+    // Choose the best move
+    play_move(s, tree.best_move(), NULL);
+    return s;
+}
+
+/**
+ * Plays a whole game on a board of size N, MCTS against MCTS.
+ * @param iteration The time (or number of iterations) of one move, or the
+ * main time of each player for the game (TIME_MANAGER).
+ * @param playout_num The time (or number of games) of one simulation phase.
+ * @param thread_num The number of workers.
+ * @returns The number of rounds played.
+ */
+template <int N>
+int play_game(float iteration, float playout_num, int thread_num) {
+    // The trees used in MCTS, one per player
+    Tree trees[2];
+    for (int i = 0; i < 2; ++i)
+        trees[i].set_budget(tree_budget(2));  // They share the memory budget of the process
+    Position<N> *s = new Position<N>();
+#if TIME_MANAGER
+    // The clocks of the players: iteration is the main time of each one, and
+    // then the time of every move
+    TimeManager clocks[2] = {TimeManager(iteration, BYO_YOMI), TimeManager(iteration, BYO_YOMI)};
+#endif
+    int round_num = 0;
+
+    // Start the workers, for the whole game
+    LeafPool<N> *pool = new LeafPool<N>();
+    pool->oldest.store(0);
+    pool->stop.store(false);
+    pool->sleeping.store(0);
+    pthread_mutex_init(&pool->sleep_mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    for (int i = 0; i < LEAF_PIPELINE; ++i) {
+        pool->leaves[i].open.store(false);
+        pool->leaves[i].active.store(0);
+    }
+
+    pthread_t *threads = new pthread_t[thread_num];
+    LeafWorker<N> *workers = new LeafWorker<N>[thread_num];
+    for (int i = 0; i < thread_num; ++i) {
+        workers[i].pool = pool;
+        workers[i].threadIndex = i;
+        pthread_create(&threads[i], NULL, leaf_worker<N>, &workers[i]);
+    }
+
+    while (!s->game_over()) {
+#if VISUAL
+        cout << endl
+             << "========= Round: " << round_num << " ==========" << endl;
+        cout << "========== Player 1 ==========" << endl;
+#endif
+#if TIME_MANAGER
+        iteration = clocks[0].start_move(*s);
+#endif
+        s = mcts_play(s, iteration, playout_num, trees[0], *pool, thread_num);
+#if TIME_MANAGER
+        clocks[0].end_move(trees[0], true);
+#endif
+
+#if VISUAL
+        s->print();
+#endif
+        round_num += 1;
+        if (s->game_over())
+            break;
+
+#if VISUAL
+        cout << "========== Player 2 ==========" << endl;
+#endif
+#if TIME_MANAGER
+        iteration = clocks[1].start_move(*s);
+#endif
+        s = mcts_play(s, iteration, playout_num, trees[1], *pool, thread_num);
+#if TIME_MANAGER
+        clocks[1].end_move(trees[1], true);
+#endif
+
+#if VISUAL
+        s->print();
+#endif
+    }
+
+#if TIME_MANAGER
+    for (int i = 0; i < 2; ++i) {
+        main_time_left[i] = clocks[i].main_left();
+        moves_over_time += clocks[i].over_time();
+    }
+#endif
+
+    // Stop the workers and release memory
+    pool->stop.store(true);
+    pool->wake();
+    for (int i = 0; i < thread_num; ++i)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&pool->sleep_mutex);
+    pthread_cond_destroy(&pool->work);
+
+    delete[] threads;
+    delete[] workers;
+    delete pool;
+    delete s;
+
+    return round_num;
+}
+
+int main(int argc, char **argv) {
+    srand(time(0));
+    random_seed = time(0);
+
+    double times1[2];
+    double times2[2];
+    int round_num = 0;
+    int thread_num;
+    float playout_num, iteration;
+    int board_size = DEFAULT_BOARD_SIZE;
+
+    if (argc != 4 && argc != 5) {
+        cout << "usage: <iteration/time_round> <playout_num/time_sim> <num_workers> [board_size: 9, 13, 19]" << endl;
+        return 0;
+    }
+
+#if USE_TIME_ROUND
+    iteration = atof(argv[1]);
+#else
+    iteration = atoi(argv[1]);
+#endif
+
+#if USE_TIME_SIM
+    playout_num = atof(argv[2]);
+#else
+    playout_num = atoi(argv[2]);
+#endif
+
+    thread_num = atoi(argv[3]);
+    if (thread_num < 1) {
+        cout << "There must be at least one worker" << endl;
+        return 0;
+    }
+
+    if (argc == 5)
+        board_size = atoi(argv[4]);
+    if (board_size != 9 && board_size != 13 && board_size != 19) {
+        cout << "The board size must be 9, 13 or 19" << endl;
+        return 0;
+    }
+
+#if LOG
+    timing(times1, times1 + 1);
+#endif
+
+    switch (board_size) {
+    case 9:
+        round_num = play_game<9>(iteration, playout_num, thread_num);
+        break;
+    case 13:
+        round_num = play_game<13>(iteration, playout_num, thread_num);
+        break;
+    case 19:
+        round_num = play_game<19>(iteration, playout_num, thread_num);
+        break;
+    }
+
+#if LOG
+    timing(times2, times2 + 1);
+
+    cout << endl << "==== Game finished ====" << endl;
+    cout << "Number of rounds played: " << round_num << endl;
+    cout << "Total number of simulated games: " << total_num_games << " " << endl;
+    cout << "Total number of simulated rounds: " << total_num_rounds << " " << endl;
+    cout << "Total number of simulated steps: " << total_num_steps << " " << endl;
+    cout << "Peak tree memory (MB): " << peak_tree_bytes / 1048576.0 << " of " << PROCESS_MAX_MB << endl;
+#if TIME_MANAGER
+    cout << "Main time left (seconds): " << main_time_left[0] << " " << main_time_left[1] << endl;
+    cout << "Moves over the time: " << moves_over_time << endl;
+#endif
+    cout << endl;
+    cout << "Total time (seconds): " << times2[0] - times1[0] << endl;
+    cout << "Average time for one round (seconds): " << (times2[0] - times1[0]) / round_num << endl;
+    cout << endl;
+#endif
+
+    return 0;
+}
@@ -0,0 +1,455 @@
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <vector>
+
+#include "GoGame_mcts.h"
+#include "GoGame_playout.h"
+
+using namespace std;
+
+#define VISUAL              0   // For visualizing the game
+#define LOG                 1   // For printing the result of every game
+
+#define USE_TIME_ROUND      1   // 1 = Use time; 0 = Use iterations
+#define TIME_PER_ROUND      0.5   // In seconds
+#define TIME_MANAGER        0   // 1 = time_round is the main time of each player for the game (TimeManager)
+#define BYO_YOMI            0.0 // ... then the time of every move (0 = sudden death)
+
+#define USE_TIME_SIM        1   // 1 = Use time; 0 = Use iterations
+#define TIME_PER_SIM        0.05 // In seconds
+#define EARLY_STOP          0   // 1 = Both players stop a search once the games left cannot change its move (0 keeps their time equal)
+
+/* The two players of the match: the one under test (A) and the baseline (B).
+   By default B does not widen the moves; make run_match MATCH_FLAGS=... sets
+   them with -D, e.g. -DRAVE_EQUIV_B=0 -DWIDEN_BASE_A=0 for RAVE alone */
+#ifndef RAVE_EQUIV_A
+#define RAVE_EQUIV_A        RAVE_EQUIV
+#endif
+#ifndef RAVE_EQUIV_B
+#define RAVE_EQUIV_B        RAVE_EQUIV
+#endif
+#ifndef WIDEN_BASE_A
+#define WIDEN_BASE_A        WIDEN_BASE
+#endif
+#ifndef WIDEN_BASE_B
+#define WIDEN_BASE_B        0
+#endif
+
+
+/**
+ * Measures the time.
+ * @param wcTime The time measured on world clock
+ * @param cpuTime The time measured on CPU
+ */
+void timing(double *wcTime, double *cpuTime) {
+    struct timeval tp;
+    struct rusage ruse;
+
+    gettimeofday(&tp, NULL);
+    *wcTime = (double)(tp.tv_sec + tp.tv_usec / 1000000.0);
+
+    getrusage(RUSAGE_SELF, &ruse);
+    *cpuTime = (double)(ruse.ru_utime.tv_sec + ruse.ru_utime.tv_usec / 1000000.0);
+}
+
+/**
+ * Lists the moves from current state: the pass when the player cannot put a
+ * stone, else every legal point, the ones far from the edge first.
+ * @param s Current state.
+ * @param moves The points where to put a stone (-1 for the pass), returned by
+ * side effect.
+ * @returns The number of moves.
+ */
+template <int N>
+int get_next_moves(Position<N> *s, int *moves) {
+    // If pass move, then the next move is only the "pass move"
+    if (s->is_pass()) {
+        moves[0] = -1;
+        return 1;
+    }
+
+    // The points from the 4th line inwards first, then the 3rd, 2nd and 1st
+    // lines: a cheap prior, as the selection opens the first moves of a node
+    // first until they have AMAF scores (see Tree::prior)
+    static const Bitboard<N> rings[3] = {inner_points<N>(3), inner_points<N>(2), inner_points<N>(1)};
+
+    int move_num = 0;
+    Bitboard<N> legal = s->legal_moves();
+    for (int i = 0; i <= 3; ++i) {
+        Bitboard<N> ring = i < 3 ? legal & rings[i] : legal;
+        legal = legal - ring;
+        while (ring.any()) {
+            int p = ring.first();
+            ring.reset(p);
+            moves[move_num++] = p;
+        }
+    }
+    return move_num;
+}
+
+/**
+ * Plays a move given by get_next_moves.
+ * @param s The current state.
+ * @param move The point where to put the stone, -1 for the pass.
+ * @param undo When given, records the move to take it back.
+ */
+template <int N>
+void play_move(Position<N> *s, int move, Undo *undo) {
+    if (move == -1)
+        s->pass_move(undo);
+    else
+        s->play(move, undo);
+}
+
+/**
+ * This is a random player.
+ * @param s The current state.
+ */
+template <int N>
+void random_play(Position<N> *s) {
+    if (!s->is_pass()) {
+        Bitboard<N> moves = s->legal_moves();
+        int p = moves.nth(rand() % moves.count());
+        s->make_move(Position<N>::row(p), Position<N>::col(p));
+    } else {
+        s->pass_move();
+    }
+}
+
+/**
+ * This is for manual play (playing against a human).
+ * @param s The current state.
+ */
+template <int N>
+void manual_play(Position<N> *s) {
+    if (!s->is_pass()) {
+        int x, y;
+        do {
+            cin >> x >> y;
+        } while (s->make_move(x, y) == -1);
+    } else {
+        s->pass_move();
+    }
+}
+
+/* Total number of games, rounds and steps played */
+unsigned long total_num_games = 0;
+unsigned long total_num_rounds = 0;
+unsigned long total_num_steps = 0;
+
+/* The clocks of the players at the end of the game, see TIME_MANAGER */
+double main_time_left[2] = {0, 0};
+int moves_over_time = 0;
+
+/* The seed of the simulations; every thread draws from its own generator */
+uint64_t random_seed = 0;
+
+/**
+ * This is MCTS play.
+ * @param s The current state.
+ * @param iters The number of games played for simulation phase.
+ * @param playout_num The number of simulations in MCTS.
+ * @returns A new state after choosing a move.
+ */
+template <int N>
+Position<N> *mcts_play(Position<N> *s, float iters, float playout_num, Tree &tree) {
+    int my_player = s->player;
+    int root_color = s->player == 1 ? 0 : 1;  // As in Position::stones, for AMAF
+#if EARLY_STOP
+    bool maximize = s->player == my_player;  // For decided_move
+    double played = 0;  // The games of this search
+#endif
+
+    // The player cannot put a stone. Pass move!
+    if (s->is_pass()) {
+        s->pass_move();
+        return s;
+    }
+
+    // The tree of this search, rooted at the current state: what the tree of
+    // the previous move collected under it, else an empty tree
+    int root_moves[Position<N>::POINTS];
+    int root_move_num = get_next_moves(s, root_moves);
+    tree.advance(s->key, root_moves, root_move_num);
+
+    Position<N> &t = *s;  // Walks down the tree and back up
+    // Reused by every move, so the search allocates nothing once they have
+    // grown to the longest path
+    static vector<Undo> path;  // The moves that t made from the root
+    static Path visited;  // The edges of the tree it followed
+    static Random rng(random_seed);
+    static Playout<N> playout;  // Reused by every simulation
+    static Amaf amaf;  // The moves of its games, for RAVE
+    
+    // Run the game 'iters' times
+#if USE_TIME_ROUND
+    double time1_round, time2_round, time_cpu;
+    timing(&time1_round, &time_cpu);
+    do {
+#else
+    for (int i = 0; i < iters; ++i) {
+#endif        
+        total_num_rounds++;
+
+        // Selection, down to a node that is not in the tree yet (or to the
+        // longest path, around a cycle of repeated positions)
+        uint32_t node = tree.root();
+        while (!t.game_over() && !visited.full()) {
+            // List the moves the first time the node is reached
+            if (!tree.expanded(node)) {
+                int moves[Position<N>::POINTS];
+                int move_num = get_next_moves(&t, moves);
+                if (!tree.expand(node, moves, move_num))
+                    break;  // The tree is full: simulate from here
+            }
+
+            // The best open move by UCB (FPU for the ones never tried)
+            uint32_t e = tree.select(node, t.player == my_player);
+            visited.push_back(e);
+            path.push_back(Undo());
+            play_move(&t, tree.edges.move[e], &path.back());
+
+            if (tree.edges.child[e] == Tree::NONE) {
+                // Explore new state (or join its node when it is in the tree)
+                tree.add_child(e, t.key, visited);
+                break;
+            }
+            node = tree.edges.child[e];
+        }
+
+        // Playout policy: Run some random games and obtain some scores
+        double total_g = 0, total_w = 0;
+        if (t.game_over()) {
+            // 't' is a final state, just update the scores
+            if (t.who_win() == my_player) {
+                total_g = playout_num;
+                total_w = playout_num;
+            } else if (t.who_win() == 0) {
+                total_g = playout_num;
+                total_w = playout_num / 2.0;
+            } else {
+                total_g = playout_num;
+                total_w = 0;
+            }
+        } else {
+            // Run simulations 'playout_num' times
+#if USE_TIME_SIM
+                double time1_sim, time2_sim, time_cpu;
+                timing(&time1_sim, &time_cpu);
+                do {
+#else
+                for (int j = 0; j < playout_num; ++j) {
+#endif
+                // Run a random simulation
+                total_num_games++;
+                int winner = playout.run(t, rng, &total_num_steps);
+
+                // Update the scores based on the result of the last game
+                if (winner == my_player) {
+                    total_g += 1;
+                    total_w += 1;
+                } else if (winner == 0) {
+                    total_g += 1;
+                    total_w += 0.5;
+                } else {
+                    total_g += 1;
+                    total_w += 0;
+                }
+                amaf.add_game(playout, winner == my_player ? 1 : winner == 0 ? 0.5 : 0);
+#if USE_TIME_SIM
+                    timing(&time2_sim, &time_cpu);
+                } while (time2_sim - time1_sim < playout_num);
+#else
+                }
+#endif        
+        }
+
+        // Back propagate the result
+        tree.update(visited, total_g, total_w);
+        tree.update_amaf(visited, root_color, amaf, total_g, total_w);
+        amaf.clear();
+        visited.clear();
+
+        // Stay within the memory budget of the tree
+        if (tree.full())
+            tree.prune();
+
+        // Go back up to the root
+        while (!path.empty()) {
+            t.unmake_move(path.back());
+            path.pop_back();
+        }
+
+#if USE_TIME_ROUND
+        timing(&time2_round, &time_cpu);
+#endif
+#if EARLY_STOP
+        // Stop once the games left cannot change the move chosen
+        played += total_g;
+#if USE_TIME_ROUND
+        double done = (time2_round - time1_round) / iters;
+#else
+        double done = (i + 1.0) / iters;
+#endif
+        if (tree.decided(played, done, maximize) >= 0)
+            break;
+#endif
+
+#if USE_TIME_ROUND
+    } while (time2_round - time1_round < iters);
+#else
+    }
+#endif
+
+    // Choose the best move
+    play_move(s, tree.best_move(s->player == my_player), NULL);
+    return s;
+}
+
+/**
+ * Plays a whole game on a board of size N, the player A against the player
+ * B, both with the same time per move.
+ * @param iteration The time (or number of iterations) of one move, or the
+ * main time of each player for the game (TIME_MANAGER).
+ * @param playout_num The time (or number of games) of one simulation phase.
+ * @param a_first True when A plays first (player 1).
+ * @returns The winner: 1 for A, -1 for B, 0 for a draw.
+ */
+template <int N>
+int play_game(float iteration, float playout_num, bool a_first) {
+    // The trees of the players, player 1 first
+    Tree trees[2];
+    for (int i = 0; i < 2; ++i)
+        trees[i].set_budget(tree_budget(2));  // They share the memory budget of the process
+    trees[0].rave_equiv = a_first ? RAVE_EQUIV_A : RAVE_EQUIV_B;
+    trees[1].rave_equiv = a_first ? RAVE_EQUIV_B : RAVE_EQUIV_A;
+    trees[0].widen_base = a_first ? WIDEN_BASE_A : WIDEN_BASE_B;
+    trees[1].widen_base = a_first ? WIDEN_BASE_B : WIDEN_BASE_A;
+    Position<N> *s = new Position<N>();
+#if TIME_MANAGER
+    // The clocks of the players: iteration is the main time of each one, and
+    // then the time of every move
+    TimeManager clocks[2] = {TimeManager(iteration, BYO_YOMI), TimeManager(iteration, BYO_YOMI)};
+#endif
+
+    while (!s->game_over()) {
+#if TIME_MANAGER
+        iteration = clocks[0].start_move(*s);
+#endif
+        s = mcts_play(s, iteration, playout_num, trees[0]);
+#if TIME_MANAGER
+        clocks[0].end_move(trees[0], true);
+#endif
+#if VISUAL
+        s->print();
+#endif
+        if (s->game_over())
+            break;
+
+#if TIME_MANAGER
+        iteration = clocks[1].start_move(*s);
+#endif
+        s = mcts_play(s, iteration, playout_num, trees[1]);
+#if TIME_MANAGER
+        clocks[1].end_move(trees[1], true);
+#endif
+#if VISUAL
+        s->print();
+#endif
+    }
+
+#if TIME_MANAGER
+    for (int i = 0; i < 2; ++i) {
+        main_time_left[i] = clocks[i].main_left();
+        moves_over_time += clocks[i].over_time();
+    }
+#endif
+
+    int winner = s->who_win();
+    delete s;
+    return a_first ? winner : -winner;
+}
+
+int main(int argc, char **argv) {
+    srand(time(0));
+    random_seed = time(0);
+
+    float playout_num, iteration;
+    int game_num;
+    int board_size = DEFAULT_BOARD_SIZE;
+
+    if (argc != 4 && argc != 5) {
+        cout << "usage: <iteration/time_round> <playout_num/time_sim> <game_num> [board_size: 9, 13, 19]" << endl;
+        return 0;
+    }
+
+#if USE_TIME_ROUND
+    iteration = atof(argv[1]);
+#else
+    iteration = atoi(argv[1]);
+#endif
+
+#if USE_TIME_SIM
+    playout_num = atof(argv[2]);
+#else
+    playout_num = atoi(argv[2]);
+#endif
+
+    game_num = atoi(argv[3]);
+    if (argc == 5)
+        board_size = atoi(argv[4]);
+    if (board_size != 9 && board_size != 13 && board_size != 19) {
+        cout << "The board size must be 9, 13 or 19" << endl;
+        return 0;
+    }
+
+    // A and B take turns at playing first
+    int wins_a = 0, wins_b = 0, draws = 0;
+    for (int g = 0; g < game_num; ++g) {
+        bool a_first = g % 2 == 0;
+        int winner = 0;
+
+        switch (board_size) {
+        case 9:
+            winner = play_game<9>(iteration, playout_num, a_first);
+            break;
+        case 13:
+            winner = play_game<13>(iteration, playout_num, a_first);
+            break;
+        case 19:
+            winner = play_game<19>(iteration, playout_num, a_first);
+            break;
+        }
+
+        if (winner == 1)
+            wins_a++;
+        else if (winner == -1)
+            wins_b++;
+        else
+            draws++;
+#if LOG
+        cout << "Game " << g + 1 << ": " << (winner == 1 ? "A" : winner == -1 ? "B" : "nobody")
+             << " wins (A plays " << (a_first ? "first" : "second") << ")" << endl;
+#endif
+    }
+
+    cout << endl << "==== Match finished ====" << endl;
+    cout << "Player A: RAVE_EQUIV " << RAVE_EQUIV_A << ", WIDEN_BASE " << WIDEN_BASE_A << endl;
+    cout << "Player B: RAVE_EQUIV " << RAVE_EQUIV_B << ", WIDEN_BASE " << WIDEN_BASE_B << endl;
+    cout << "Games won by A: " << wins_a << endl;
+    cout << "Games won by B: " << wins_b << endl;
+    cout << "Draws: " << draws << endl;
+    cout << "Win rate of A: " << (wins_a + draws / 2.0) / game_num << endl;
+    cout << "Total number of simulated games: " << total_num_games << " " << endl;
+#if TIME_MANAGER
+    cout << "Moves over the time: " << moves_over_time << endl;
+#endif
+
+    return 0;
+}
@@ -0,0 +1,2189 @@
+#ifndef GOGAME_MCTS_H
+#define GOGAME_MCTS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <sys/time.h>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define UCB_Z               0.2 // The exploration constant of UCB
+#define TT_SIZE_MB          4   // The transposition table of every tree (at most 1/8 of its budget)
+#define PROCESS_MAX_MB      512 // The memory budget of all the trees of a process, tables included
+#define MAX_DEPTH           1024 // The longest descent of the search
+#define VIRTUAL_LOSS        1   // The games lost by a move while a thread searches it
+#define RAVE_EQUIV          1000 // The games of a move at which its AMAF average weighs 1/2 (0 = no RAVE)
+#define WIDEN_BASE          4   // The moves open to the selection at a new node (0 = all of them)
+#define WIDEN_EXPONENT      0.7 // ... plus the games of the node to this power
+#define FPU                 1.0 // The UCB value of a move never tried (first play urgency)
+#define AMAF_POINTS         420 // The points of the largest board, its border included
+#define TM_MOVES_PER_POINT  0.5 // The moves left to a player per empty point (TimeManager)
+#define TM_MIN_MOVES        8   // ... never fewer than this
+#define TM_MAX_SHARE        0.25 // The most of the main time left that one move takes
+#define TM_BYO_YOMI_USE     0.8 // The part of a byo-yomi period that one move takes
+#define TM_DECIDED          0.85 // A best average past it (or below 1 - it) decides the game...
+#define TM_DECIDED_SCALE    0.5 // ... and the next move gets this part of its share
+#define TM_CLOSE            0.7 // A second move with this part of the games of the best one...
+#define TM_CLOSE_SCALE      1.6 // ... makes the next move get this part of its share
+#define EARLY_STOP_DECIDED  0   // 1 = Early stop also ends a search whose game is decided:
+#define EARLY_STOP_SURE     0.9 // ... a best average past it (or below 1 - it)...
+#define EARLY_STOP_SURE_DONE 0.25 // ... once this part of its budget is spent
+#define EARLY_STOP_CHECKS   8   // The points of the budget of a search where the MPI processes check together
+
+/**
+ * A move of a node of the search tree, with the scores of the games played
+ * through it. The wins are counted for the player at the root of the search.
+ */
+struct Edge {
+    int16_t move;       // The point of the stone, -1 for the pass
+    uint32_t child;     // The node reached by the move, NONE until expanded
+    float total_game;
+    float total_win;
+    float amaf_game;    // The games where the player put a stone there first
+    float amaf_win;     // (all moves as first), for RAVE
+};
+
+/**
+ * The edges of a search tree as a structure of arrays, one array per field of
+ * Edge, so that the scores of the moves of a node are contiguous and the
+ * selection loads them a SIMD register at a time (see Tree::select). The
+ * fields are read and written by index, e.g. edges.games[e]; at and
+ * push_back move a whole Edge.
+ */
+struct EdgeArrays {
+    // The bytes of one edge
+    static const size_t BYTES = sizeof(int16_t) + sizeof(uint32_t) + 4 * sizeof(float);
+
+    std::vector<int16_t> move;
+    std::vector<uint32_t> child;
+    std::vector<float> games;
+    std::vector<float> wins;
+    std::vector<float> amaf_games;
+    std::vector<float> amaf_wins;
+
+    size_t size() const {
+        return move.size();
+    }
+
+    size_t capacity() const {
+        return move.capacity();
+    }
+
+    Edge at(size_t i) const {
+        Edge e;
+        e.move = move[i];
+        e.child = child[i];
+        e.total_game = games[i];
+        e.total_win = wins[i];
+        e.amaf_game = amaf_games[i];
+        e.amaf_win = amaf_wins[i];
+        return e;
+    }
+
+    void push_back(const Edge &e) {
+        move.push_back(e.move);
+        child.push_back(e.child);
+        games.push_back(e.total_game);
+        wins.push_back(e.total_win);
+        amaf_games.push_back(e.amaf_game);
+        amaf_wins.push_back(e.amaf_win);
+    }
+
+    void clear() {
+        move.clear();
+        child.clear();
+        games.clear();
+        wins.clear();
+        amaf_games.clear();
+        amaf_wins.clear();
+    }
+
+    void reserve(size_t n) {
+        move.reserve(n);
+        child.reserve(n);
+        games.reserve(n);
+        wins.reserve(n);
+        amaf_games.reserve(n);
+        amaf_wins.reserve(n);
+    }
+
+    void swap(EdgeArrays &other) {
+        move.swap(other.move);
+        child.swap(other.child);
+        games.swap(other.games);
+        wins.swap(other.wins);
+        amaf_games.swap(other.amaf_games);
+        amaf_wins.swap(other.amaf_wins);
+    }
+};
+
+/**
+ * A node of the search tree: its moves are the edges [first_edge,
+ * first_edge + edge_num), listed all at once the first time the search goes
+ * through the node.
+ */
+struct Node {
+    uint32_t first_edge;
+    uint16_t edge_num;  // 0 until the moves are listed
+    float total_game;   // The games played through the node
+};
+
+/**
+ * A fixed-size hash table from the Zobrist key of a position to its node in
+ * the search tree, so that the moves reaching the same position by different
+ * orders share one node. Open addressing: a key lives in one bucket of four
+ * entries, a cache line, so a lookup is one miss. Entries written by an
+ * earlier search are free; when a bucket is full the entry of the node with
+ * the fewest games is replaced (the node stays in the tree, it just stops
+ * being shared).
+ */
+class TranspositionTable {
+public:
+    struct Entry {
+        uint64_t key;
+        uint32_t node;
+        uint32_t search;    // The search that wrote the entry, 0 when empty
+    };
+
+    static const int BUCKET = 4;
+
+    TranspositionTable(size_t bytes = (size_t)TT_SIZE_MB << 20)
+        : entries(NULL), mask(0), search(1) {
+        resize(bytes);
+    }
+
+    /**
+     * Sets the memory of the table (at most bytes), forgetting its entries.
+     */
+    void resize(size_t bytes) {
+        free(entries);
+        entries = NULL;
+        size_t buckets = 1;
+        while (buckets * 2 * BUCKET * sizeof(Entry) <= bytes)
+            buckets *= 2;
+        mask = buckets - 1;
+        size = buckets * BUCKET * sizeof(Entry);
+    }
+
+    ~TranspositionTable() {
+        free(entries);
+    }
+
+    /**
+     * Forgets every entry, in constant time.
+     */
+    void new_search() {
+        search++;
+    }
+
+    /**
+     * Returns the node of a position, or 0 (the root, never a child) when the
+     * position is not in the table.
+     */
+    uint32_t find(uint64_t key) const {
+        if (!entries)
+            return 0;
+
+        const Entry *b = bucket(key);
+        for (int i = 0; i < BUCKET; ++i)
+            if (b[i].key == key && b[i].search == search)
+                return b[i].node;
+        return 0;
+    }
+
+    /**
+     * Adds the node of a position.
+     * @param nodes The nodes of the tree, to choose the entry to replace.
+     */
+    void insert(uint64_t key, uint32_t node, const std::vector<Node> &nodes) {
+        if (!entries)
+            allocate();
+
+        Entry *b = bucket(key);
+        Entry *victim = &b[0];
+        for (int i = 0; i < BUCKET; ++i) {
+            if (b[i].search != search) {
+                victim = &b[i];
+                break;
+            }
+            if (nodes[b[i].node].total_game < nodes[victim->node].total_game)
+                victim = &b[i];
+        }
+
+        victim->key = key;
+        victim->node = node;
+        victim->search = search;
+    }
+
+    /**
+     * Moves the entries of the search to other nodes, e.g. after the nodes of
+     * the tree were compacted.
+     * @param to The new index of every node, 0 or UNSEEN to drop its entry.
+     */
+    void renumber(const std::vector<uint32_t> &to) {
+        if (!entries)
+            return;
+
+        Entry *end = entries + (mask + 1) * BUCKET;
+        for (Entry *e = entries; e != end; ++e) {
+            if (e->search != search)
+                continue;
+            if (to[e->node] == 0 || to[e->node] == UNSEEN)
+                e->search = 0;
+            else
+                e->node = to[e->node];
+        }
+    }
+
+    static const uint32_t UNSEEN = 0xffffffff;
+
+    /**
+     * The memory of the table in bytes.
+     */
+    size_t bytes() const {
+        return size;
+    }
+
+private:
+    Entry *entries;
+    size_t mask;
+    size_t size;
+    uint32_t search;
+
+    TranspositionTable(const TranspositionTable &) = delete;
+    TranspositionTable &operator=(const TranspositionTable &) = delete;
+
+    Entry *bucket(uint64_t key) const {
+        return entries + (key & mask) * BUCKET;
+    }
+
+    /* Only the trees that search get a table */
+    void allocate() {
+        void *p = NULL;
+        if (posix_memalign(&p, 64, size) != 0)
+            abort();
+        memset(p, 0, size);
+        entries = (Entry *)p;
+    }
+};
+
+/**
+ * The edges followed by one descent of the search, from the root down. The
+ * backpropagation updates exactly these, so a node with several parents (see
+ * Tree) is credited along the way the simulation went, and never through a
+ * pointer to a parent. One per thread, reused by every simulation; the
+ * descent stops when it is full, which also ends the cycles that repeated
+ * positions make in the tree.
+ */
+class Path {
+public:
+    Path() : length(0) {
+    }
+
+    void push_back(uint32_t edge) {
+        edges[length++] = edge;
+    }
+
+    void clear() {
+        length = 0;
+    }
+
+    bool full() const {
+        return length == MAX_DEPTH;
+    }
+
+    int size() const {
+        return length;
+    }
+
+    uint32_t operator[](int i) const {
+        return edges[i];
+    }
+
+private:
+    uint32_t edges[MAX_DEPTH];
+    int length;
+};
+
+/**
+ * The moves of the simulation of a leaf, for the AMAF scores of the moves on
+ * its path: for every color (as in Position::stones) and point, the games
+ * where the player put a stone there first and their wins, and whether the
+ * player played there in the tree (Tree::update_amaf marks it on the way up).
+ */
+class Amaf {
+public:
+    Amaf() {
+        clear();
+    }
+
+    void clear() {
+        memset(games, 0, sizeof(games));
+        memset(wins, 0, sizeof(wins));
+        memset(in_tree, 0, sizeof(in_tree));
+    }
+
+    /**
+     * Adds a game of the simulation.
+     * @param playout The playout that played it, see Playout::first_moves.
+     * @param win Its score for the player at the root of the tree (1, 0.5
+     * or 0).
+     */
+    template <class P>
+    void add_game(const P &playout, double win) {
+        for (int color = 0; color < 2; ++color) {
+            auto points = playout.first_moves(color);
+            while (points.any()) {
+                int p = points.first();
+                points.reset(p);
+                games[color][p] += 1;
+                wins[color][p] += win;
+            }
+        }
+    }
+
+    void add_tree_move(int color, int move) {
+        if (move >= 0)
+            in_tree[color][move] = 1;
+    }
+
+    /**
+     * The AMAF games and wins of a move: all the games of the simulation when
+     * the player played there in the tree, else the ones where it did in the
+     * game. The pass has none.
+     * @returns False when there is none.
+     */
+    bool scores(int color, int move, double total_g, double total_w, double &g, double &w) const {
+        if (move < 0)
+            return false;
+        if (in_tree[color][move]) {
+            g = total_g;
+            w = total_w;
+            return true;
+        }
+        g = games[color][move];
+        w = wins[color][move];
+        return g > 0;
+    }
+
+private:
+    float games[2][AMAF_POINTS];
+    float wins[2][AMAF_POINTS];
+    uint8_t in_tree[2][AMAF_POINTS];
+};
+
+#if !defined(__AVX2__) && defined(__SSE2__)
+/* The lanes of b where mask is set, else the ones of a (blendv before SSE4.1) */
+static inline __m128 select_ps(__m128 a, __m128 b, __m128 mask) {
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+#endif
+
+/**
+ * The scores of a move of the root, for decided_move.
+ */
+struct RootScore {
+    float games;
+    float wins;
+    float amaf_games;
+    float amaf_wins;
+};
+
+/**
+ * The games a search is expected to play still: as many per part of its
+ * budget (time or iterations) as it played so far.
+ * @param played The games played by the search so far.
+ * @param done The part of the budget spent.
+ */
+inline double games_left(double played, double done) {
+    if (done >= 1)
+        return 0;
+    return done > 0 ? played * (1 - done) / done : INFINITY;
+}
+
+/**
+ * The range of the score (see Tree::score) that a move of the root can end
+ * a search with, whatever the games left do: its average between all of
+ * them lost and all of them won, likewise its AMAF average, and the weight
+ * of the AMAF average between its games now and its games at the end.
+ * @param left The games left, see games_left.
+ * @param in_flight The virtual losses on the move, whose games and wins are
+ * not real.
+ * @param lo Set to the lowest score.
+ * @param hi Set to the highest score.
+ */
+inline void score_range(const RootScore &m, float rave_equiv, double left, double in_flight,
+                        double *lo, double *hi) {
+    double games = m.games + left;
+    double real = m.games > in_flight ? m.games - in_flight : 0;
+    double average_lo = games > 0 ? (m.wins > in_flight ? m.wins - in_flight : 0) / games : 0;
+    double average_hi = real + left > 0 ? (m.wins + left) / (real + left) : 1;
+    if (average_hi > 1)
+        average_hi = 1;
+
+    // The AMAF average counts once it has games: it may get some
+    double beta_lo = 0, beta_hi = 0;
+    if (rave_equiv > 0 && (m.amaf_games > 0 || left > 0)) {
+        beta_lo = m.amaf_games > 0 ? sqrt(rave_equiv / (3 * games + rave_equiv)) : 0;
+        beta_hi = sqrt(rave_equiv / (3 * (real > 1 ? real : 1) + rave_equiv));
+    }
+    double amaf_games = m.amaf_games + left;
+    double amaf_lo = amaf_games > 0 ? m.amaf_wins / amaf_games : 0;
+    double amaf_hi = amaf_games > 0 ? (m.amaf_wins + left) / amaf_games : 1;
+
+    // Linear in the weight, so the extremes are at the ends of its range
+    double lo_a = (1 - beta_lo) * average_lo + beta_lo * amaf_lo;
+    double lo_b = (1 - beta_hi) * average_lo + beta_hi * amaf_lo;
+    double hi_a = (1 - beta_lo) * average_hi + beta_lo * amaf_hi;
+    double hi_b = (1 - beta_hi) * average_hi + beta_hi * amaf_hi;
+    *lo = lo_a < lo_b ? lo_a : lo_b;
+    *hi = hi_a > hi_b ? hi_a : hi_b;
+}
+
+/**
+ * The move of the root that the rest of a search cannot change (early
+ * stop): the one Tree::best_move chooses now (the best score among the
+ * moves played), when no score it can end with is below the best score
+ * that any other move can end with (see score_range). With
+ * EARLY_STOP_DECIDED, a game decided either way (a best score past
+ * EARLY_STOP_SURE, or below 1 - it) also stops once EARLY_STOP_SURE_DONE of
+ * the budget is spent, if no other move can catch up with the games of the
+ * best one.
+ * @param scores The scores of every move of the root.
+ * @param rave_equiv The one of the tree, see RAVE_EQUIV.
+ * @param played The games played by the search so far.
+ * @param done The part of its budget spent.
+ * @param in_flight The most virtual losses on a move, see score_range.
+ * @param maximize False when the scores are the ones of the other player.
+ * @returns Its place among the moves of the root, -1 while the search should
+ * go on.
+ */
+inline int decided_move(const RootScore *scores, int move_num, float rave_equiv, double played,
+                        double done, double in_flight, bool maximize) {
+    double left = games_left(played, done);
+    if (left == INFINITY)
+        return -1;
+    double lo[AMAF_POINTS], hi[AMAF_POINTS];
+    double value = -10.0;
+    int best = -1;
+    for (int j = 0; j < move_num; ++j) {
+        // The ranges of the score for the player to move
+        double l, h;
+        score_range(scores[j], rave_equiv, left, in_flight, &l, &h);
+        lo[j] = maximize ? l : 1 - h;
+        hi[j] = maximize ? h : 1 - l;
+        if (scores[j].games <= 0)
+            continue;
+
+        // The score of Tree::score, in the same order of operations
+        const RootScore &m = scores[j];
+        double score = m.wins / m.games;
+        if (rave_equiv > 0 && m.amaf_games > 0) {
+            double beta = sqrt(rave_equiv / (3 * m.games + rave_equiv));
+            score = (1 - beta) * m.wins / m.games + beta * m.amaf_wins / m.amaf_games;
+        }
+        double tmp = maximize ? score : -score;
+        if (value < tmp) {
+            value = tmp;
+            best = j;
+        }
+    }
+    if (best < 0)
+        return -1;
+
+#if EARLY_STOP_DECIDED
+    double average = maximize ? value : 1 + value;
+    if (done >= EARLY_STOP_SURE_DONE &&
+        (average > EARLY_STOP_SURE || average < 1 - EARLY_STOP_SURE)) {
+        bool ahead = true;
+        for (int j = 0; j < move_num && ahead; ++j)
+            ahead = j == best || scores[best].games - scores[j].games > left;
+        if (ahead)
+            return best;
+    }
+#endif
+
+    for (int j = 0; j < move_num; ++j) {
+        // A move with no games gets in only if the games left can reach it
+        if (j == best || (scores[j].games <= 0 && left <= 0))
+            continue;
+        if (hi[j] >= lo[best])
+            return -1;
+    }
+    return best;
+}
+
+/**
+ * The search tree of a player, kept from move to move (see advance). The
+ * nodes and the edges live in two arrays and refer to each other by 32-bit
+ * indices, so that the moves of a node are contiguous and the selection only
+ * scans an array, without hashing or making positions. The root is node 0. A
+ * position reached by several orders of moves is one node (found by the
+ * transposition table when the node is created), so the tree is a DAG with
+ * the statistics shared.
+ *
+ * The tree never takes more than its memory budget: the arrays hold at most
+ * a fixed number of nodes and of edges, reserved the first time the tree
+ * grows (the pages are only used as the tree fills them), and a tree that
+ * comes close to it is pruned (see full and prune).
+ */
+class Tree {
+public:
+    static const uint32_t NONE = 0;     // The root is never a child
+
+    std::vector<Node> nodes;
+    EdgeArrays edges;
+    TranspositionTable table;
+    float rave_equiv;   // See RAVE_EQUIV
+    int widen_base;     // See WIDEN_BASE
+
+    /**
+     * @param max_bytes The memory budget of the tree, see set_budget.
+     */
+    Tree(size_t max_bytes = (size_t)PROCESS_MAX_MB << 20)
+        : rave_equiv(RAVE_EQUIV), widen_base(WIDEN_BASE) {
+        set_budget(max_bytes);
+    }
+
+    /**
+     * Sets the memory budget of the tree and empties it.
+     * @param max_bytes The budget, the transposition table and the spare
+     * arrays of advance included: the share of the tree of the budget of the
+     * process (see tree_budget).
+     */
+    void set_budget(size_t max_bytes) {
+        size_t table_bytes = (size_t)TT_SIZE_MB << 20;
+        if (table_bytes > max_bytes / 8)
+            table_bytes = max_bytes / 8;
+        table.resize(table_bytes);
+
+        size_t element = 2 * sizeof(Node) + sizeof(uint32_t) + 2 * EdgeArrays::BYTES;
+        capacity = 1024;
+        if (max_bytes > table.bytes() + capacity * element)
+            capacity = (max_bytes - table.bytes()) / element;
+
+        // Give back the arrays reserved for the previous budget
+        std::vector<Node>().swap(nodes);
+        std::vector<Node>().swap(spare_nodes);
+        EdgeArrays().swap(edges);
+        EdgeArrays().swap(spare_edges);
+        std::vector<uint32_t>().swap(renumbered);
+        clear();
+    }
+
+    /**
+     * Drops every node but an empty root, all at once. The arrays keep their
+     * memory: they are the arena of the nodes of the tree, so a search no
+     * larger than the previous ones allocates nothing.
+     */
+    void clear() {
+        nodes.clear();
+        edges.clear();
+        table.new_search();
+        nodes.push_back(Node());
+        nodes[0].first_edge = 0;
+        nodes[0].edge_num = 0;
+        nodes[0].total_game = 0;
+    }
+
+    uint32_t root() const {
+        return 0;
+    }
+
+    bool expanded(uint32_t node) const {
+        return nodes[node].edge_num != 0;
+    }
+
+    int move(uint32_t edge) const {
+        return edges.move[edge];
+    }
+
+    uint32_t child(uint32_t edge) const {
+        return edges.child[edge];
+    }
+
+    /**
+     * Lists the moves of a node.
+     * @param moves The moves (points, -1 for the pass), see get_next_moves.
+     * @returns False when the tree has no room left: the node stays a leaf.
+     */
+    bool expand(uint32_t node, const int *moves, int move_num) {
+        if (!room(0, move_num))
+            return false;
+
+        nodes[node].first_edge = edges.size();
+        nodes[node].edge_num = move_num;
+        for (int i = 0; i < move_num; ++i) {
+            Edge e;
+            e.move = moves[i];
+            e.child = NONE;
+            e.total_game = 0;
+            e.total_win = 0;
+            e.amaf_game = 0;
+            e.amaf_win = 0;
+            edges.push_back(e);
+        }
+        return true;
+    }
+
+    /**
+     * Chooses the edge to follow from an expanded node, the best one by UCB
+     * over the averages of score (the highest for the player at the root,
+     * the lowest for the opponent) among the moves open at the node (see
+     * least_prior); a move never tried gets the urgency of FPU.
+     * @param maximize True when the player at the root is to move.
+     * @returns The index of the edge.
+     */
+    uint32_t select(uint32_t node, bool maximize) const {
+        const Node &n = nodes[node];
+        float T = n.total_game;
+        float least = least_prior(n.first_edge, n.edge_num, T, maximize);
+        float c = UCB_Z * log(T > 1 ? T : 1);
+
+        return n.first_edge + best_ucb(n.first_edge, n.edge_num, least, c, maximize);
+    }
+
+    /**
+     * The move with the best urgency (see urgency) among the moves of a node
+     * open to the selection, eight (AVX2) or four (SSE2) at a time, ties to
+     * the first one; the same as best_ucb_scalar, to the bit.
+     * @param first The first edge of the node.
+     * @param least The lowest prior of an open move, see least_prior.
+     * @param c UCB_Z times the log of the games of the node.
+     * @returns The place of the move among the moves of the node.
+     */
+    int best_ucb(uint32_t first, int edge_num, float least, float c, bool maximize) const {
+#if defined(__AVX2__)
+        const int W = 8;
+        const float *g = &edges.games[first], *w = &edges.wins[first];
+        const float *ag = &edges.amaf_games[first], *aw = &edges.amaf_wins[first];
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1);
+        const __m256 sign = _mm256_set1_ps(maximize ? 0.0f : -0.0f);
+        const __m256 k = _mm256_set1_ps(rave_equiv), three = _mm256_set1_ps(3);
+        const __m256 vc = _mm256_set1_ps(c), bonus_1 = _mm256_set1_ps(sqrtf(c));
+        const __m256 fpu = _mm256_set1_ps(maximize ? (float)FPU : (float)FPU - 1);
+        const __m256 rave = _mm256_castsi256_ps(_mm256_set1_epi32(rave_equiv > 0 ? -1 : 0));
+        const __m256 max = _mm256_castsi256_ps(_mm256_set1_epi32(maximize ? -1 : 0));
+        const __m256 vleast = _mm256_set1_ps(least), eight = _mm256_set1_ps(W);
+        __m256 place = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256 best = _mm256_set1_ps(-INFINITY), best_place = zero;
+        int j = 0;
+
+        for (; j + W <= edge_num; j += W, place = _mm256_add_ps(place, eight)) {
+            __m256 games = _mm256_loadu_ps(g + j), wins = _mm256_loadu_ps(w + j);
+            __m256 amaf_g = _mm256_loadu_ps(ag + j), amaf_w = _mm256_loadu_ps(aw + j);
+            __m256 tried = _mm256_cmp_ps(games, zero, _CMP_GT_OQ);
+            __m256 amaf = _mm256_and_ps(_mm256_cmp_ps(amaf_g, zero, _CMP_GT_OQ), rave);
+
+            __m256 average = _mm256_div_ps(wins, games);
+            __m256 amaf_average = _mm256_div_ps(amaf_w, amaf_g);
+            __m256 beta = _mm256_sqrt_ps(_mm256_div_ps(k, _mm256_add_ps(_mm256_mul_ps(three, games), k)));
+            __m256 blend = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, beta), average),
+                                         _mm256_mul_ps(beta, amaf_average));
+            __m256 score = _mm256_blendv_ps(average, blend, amaf);
+            __m256 bonus = _mm256_sqrt_ps(_mm256_div_ps(vc, games));
+            __m256 value = _mm256_add_ps(bonus, _mm256_xor_ps(score, sign));
+            __m256 untried = _mm256_blendv_ps(
+                fpu, _mm256_add_ps(bonus_1, _mm256_xor_ps(amaf_average, sign)), amaf);
+            value = _mm256_blendv_ps(untried, value, tried);
+
+            __m256 prior = _mm256_blendv_ps(_mm256_sub_ps(one, amaf_average), amaf_average, max);
+            prior = _mm256_blendv_ps(_mm256_sub_ps(_mm256_set1_ps(-1), place), prior, amaf);
+            __m256 better = _mm256_and_ps(_mm256_cmp_ps(prior, vleast, _CMP_GE_OQ),
+                                          _mm256_cmp_ps(value, best, _CMP_GT_OQ));
+            best = _mm256_blendv_ps(best, value, better);
+            best_place = _mm256_blendv_ps(best_place, place, better);
+        }
+
+        float lane[W], lane_place[W];
+        _mm256_storeu_ps(lane, best);
+        _mm256_storeu_ps(lane_place, best_place);
+#elif defined(__SSE2__)
+        const int W = 4;
+        const float *g = &edges.games[first], *w = &edges.wins[first];
+        const float *ag = &edges.amaf_games[first], *aw = &edges.amaf_wins[first];
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+        const __m128 sign = _mm_set1_ps(maximize ? 0.0f : -0.0f);
+        const __m128 k = _mm_set1_ps(rave_equiv), three = _mm_set1_ps(3);
+        const __m128 vc = _mm_set1_ps(c), bonus_1 = _mm_set1_ps(sqrtf(c));
+        const __m128 fpu = _mm_set1_ps(maximize ? (float)FPU : (float)FPU - 1);
+        const __m128 rave = _mm_castsi128_ps(_mm_set1_epi32(rave_equiv > 0 ? -1 : 0));
+        const __m128 max = _mm_castsi128_ps(_mm_set1_epi32(maximize ? -1 : 0));
+        const __m128 vleast = _mm_set1_ps(least), four = _mm_set1_ps(W);
+        __m128 place = _mm_setr_ps(0, 1, 2, 3);
+        __m128 best = _mm_set1_ps(-INFINITY), best_place = zero;
+        int j = 0;
+
+        for (; j + W <= edge_num; j += W, place = _mm_add_ps(place, four)) {
+            __m128 games = _mm_loadu_ps(g + j), wins = _mm_loadu_ps(w + j);
+            __m128 amaf_g = _mm_loadu_ps(ag + j), amaf_w = _mm_loadu_ps(aw + j);
+            __m128 tried = _mm_cmpgt_ps(games, zero);
+            __m128 amaf = _mm_and_ps(_mm_cmpgt_ps(amaf_g, zero), rave);
+
+            __m128 average = _mm_div_ps(wins, games);
+            __m128 amaf_average = _mm_div_ps(amaf_w, amaf_g);
+            __m128 beta = _mm_sqrt_ps(_mm_div_ps(k, _mm_add_ps(_mm_mul_ps(three, games), k)));
+            __m128 blend = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, beta), average),
+                                      _mm_mul_ps(beta, amaf_average));
+            __m128 score = select_ps(average, blend, amaf);
+            __m128 bonus = _mm_sqrt_ps(_mm_div_ps(vc, games));
+            __m128 value = _mm_add_ps(bonus, _mm_xor_ps(score, sign));
+            __m128 untried = select_ps(fpu, _mm_add_ps(bonus_1, _mm_xor_ps(amaf_average, sign)), amaf);
+            value = select_ps(untried, value, tried);
+
+            __m128 prior = select_ps(_mm_sub_ps(one, amaf_average), amaf_average, max);
+            prior = select_ps(_mm_sub_ps(_mm_set1_ps(-1), place), prior, amaf);
+            __m128 better = _mm_and_ps(_mm_cmpge_ps(prior, vleast), _mm_cmpgt_ps(value, best));
+            best = select_ps(best, value, better);
+            best_place = select_ps(best_place, place, better);
+        }
+
+        float lane[W], lane_place[W];
+        _mm_storeu_ps(lane, best);
+        _mm_storeu_ps(lane_place, best_place);
+#else
+        const int W = 1;
+        float lane[W] = {-INFINITY}, lane_place[W] = {0};
+        int j = 0;
+#endif
+        // The best of the lanes, then the moves left over
+        float value = -INFINITY;
+        int index = 0;
+        for (int i = 0; i < W; ++i) {
+            if (value < lane[i] || (value == lane[i] && lane_place[i] < index)) {
+                value = lane[i];
+                index = lane_place[i];
+            }
+        }
+        for (; j < edge_num; ++j) {
+            if (prior(first + j, j, maximize) < least)
+                continue;
+
+            float tmp = urgency(first + j, edges.wins[first + j], edges.games[first + j], c,
+                                maximize);
+            if (value < tmp) {
+                value = tmp;
+                index = j;
+            }
+        }
+        return index;
+    }
+
+    /**
+     * best_ucb one move at a time, for the machines with no SIMD (and to
+     * check and time best_ucb against).
+     */
+    int best_ucb_scalar(uint32_t first, int edge_num, float least, float c, bool maximize) const {
+        float value = -INFINITY;
+        int index = 0;
+
+        for (int j = 0; j < edge_num; ++j) {
+            if (prior(first + j, j, maximize) < least)
+                continue;
+
+            float tmp = urgency(first + j, edges.wins[first + j], edges.games[first + j], c,
+                                maximize);
+            if (value < tmp) {
+                value = tmp;
+                index = j;
+            }
+        }
+        return index;
+    }
+
+    /**
+     * The lowest prior (see prior) of the moves of a node open to the
+     * selection (progressive widening): the widen_base moves with the best
+     * priors at first, then more as the games of the node grow.
+     * @param first The first edge of the node.
+     * @param games The games played through the node.
+     * @param maximize True when the player at the root is to move.
+     */
+    float least_prior(uint32_t first, int edge_num, float games, bool maximize) const {
+        double open = widen_base + pow(games, WIDEN_EXPONENT);
+        if (widen_base <= 0 || open >= edge_num)
+            return -INFINITY;
+
+        float p[AMAF_POINTS];
+        for (int j = 0; j < edge_num; ++j)
+            p[j] = prior(first + j, j, maximize);
+        std::nth_element(p, p + (int)open - 1, p + edge_num, std::greater<float>());
+        return p[(int)open - 1];
+    }
+
+    /**
+     * The prior of a move for progressive widening: its AMAF average for the
+     * player to move, once it has one, else its place in the list of the
+     * moves of its node, the first one best (see get_next_moves).
+     * @param j The place of the move in the list.
+     */
+    float prior(uint32_t e, int j, bool maximize) const {
+        if (rave_equiv <= 0 || edges.amaf_games[e] <= 0)
+            return -1.0f - j;
+
+        float average = edges.amaf_wins[e] / edges.amaf_games[e];
+        return maximize ? average : 1 - average;
+    }
+
+    /**
+     * The UCB value of a move for the selection, for the player to move: its
+     * average (see score) plus the exploration term for the player at the
+     * root, the exploration term minus the average for the opponent, so the
+     * best move has the highest value for both. A move never tried has the
+     * value FPU for the player to move, or its AMAF average with the
+     * exploration term of one game when it has one. In floats, in the order
+     * of the operations of best_ucb.
+     * @param wins The wins of the move (its own, or with others added).
+     * @param games Its games, likewise.
+     * @param c UCB_Z times the log of the games of its node.
+     */
+    float urgency(uint32_t e, float wins, float games, float c, bool maximize) const {
+        bool amaf = rave_equiv > 0 && edges.amaf_games[e] > 0;
+        float amaf_average = edges.amaf_wins[e] / edges.amaf_games[e];
+
+        if (games > 0) {
+            float average = wins / games;
+            if (amaf) {
+                float beta = sqrtf(rave_equiv / (3.0f * games + rave_equiv));
+                average = (1 - beta) * average + beta * amaf_average;
+            }
+            float bonus = sqrtf(c / games);
+            return maximize ? bonus + average : bonus + -average;
+        }
+        if (amaf)
+            return maximize ? sqrtf(c) + amaf_average : sqrtf(c) + -amaf_average;
+        return maximize ? (float)FPU : (float)FPU - 1;
+    }
+
+    /**
+     * Sets the node at the end of an edge: the node of the same position if
+     * there is one (and it is not on the path, which would make a cycle),
+     * else a new one, when the tree has room for it.
+     * @param key The Zobrist key of the position reached by the edge.
+     * @param path The edges followed from the root, up to this one.
+     * @returns The node, NONE when the tree has no room left.
+     */
+    uint32_t add_child(uint32_t edge, uint64_t key, const Path &path) {
+        uint32_t node = table.find(key);
+        for (int i = 0; node != NONE && i < path.size(); ++i)
+            if (edges.child[path[i]] == node)
+                node = NONE;
+
+        if (node == NONE) {
+            node = add_node();
+            if (node == NONE)
+                return NONE;
+            table.insert(key, node, nodes);
+        }
+
+        edges.child[edge] = node;
+        return node;
+    }
+
+    /**
+     * Adds a node with no moves and no games, linked to nothing and left out
+     * of the transposition table.
+     * @returns The node, NONE when the tree has no room left.
+     */
+    uint32_t add_node() {
+        if (!room(1, 0))
+            return NONE;
+
+        Node n;
+        n.first_edge = 0;
+        n.edge_num = 0;
+        n.total_game = 0;
+        nodes.push_back(n);
+        return nodes.size() - 1;
+    }
+
+    /**
+     * Copies the moves of a node of another tree, with their scores and the
+     * nodes below them, to a node of this tree that has no moves yet, as far
+     * as the budget of this tree goes.
+     * @param copied The node of this tree of every node of the other one
+     * already copied (TranspositionTable::UNSEEN for the others), kept over
+     * all the grafts from the same tree so that its shared nodes stay shared.
+     */
+    void graft(uint32_t node, const Tree &from, uint32_t from_node, std::vector<uint32_t> &copied) {
+        std::vector<std::pair<uint32_t, uint32_t> > pending(1, std::make_pair(node, from_node));
+
+        while (!pending.empty()) {
+            uint32_t to = pending.back().first;
+            const Node &f = from.nodes[pending.back().second];
+            pending.pop_back();
+            if (f.edge_num == 0 || !room(0, f.edge_num))
+                continue;
+
+            nodes[to].first_edge = edges.size();
+            nodes[to].edge_num = f.edge_num;
+            for (int j = 0; j < f.edge_num; ++j) {
+                Edge e = from.edges.at(f.first_edge + j);
+                if (e.child != NONE) {
+                    uint32_t child = copied[e.child];
+                    if (child == TranspositionTable::UNSEEN) {
+                        child = add_node();
+                        if (child != NONE) {
+                            copied[e.child] = child;
+                            nodes[child].total_game = from.nodes[e.child].total_game;
+                            pending.push_back(std::make_pair(child, e.child));
+                        }
+                    }
+                    e.child = child;
+                }
+                edges.push_back(e);
+            }
+        }
+    }
+
+    /**
+     * Makes the node of a later position of the game (the one reached after
+     * the move chosen from the root and the replies) the root, with the
+     * statistics collected under it, and drops every node that cannot be
+     * reached from it. The kept nodes are copied, in breadth-first order, to
+     * a second pair of arrays that then swaps with the first one, so the
+     * memory of the tree stays the size of the largest search. Clears the
+     * tree when the position is not in it.
+     * @param key The Zobrist key of the position.
+     * @param moves The moves of the position, see get_next_moves: the node
+     * is dropped when it lists other ones (same stones, another ko).
+     * @returns True when the search goes on from the node.
+     */
+    bool advance(uint64_t key, const int *moves, int move_num) {
+        uint32_t root = table.find(key);
+        if (root == NONE || !same_moves(root, moves, move_num)) {
+            clear();
+            return false;
+        }
+
+        compact(root, 0);
+        return true;
+    }
+
+    /**
+     * True when the tree is close enough to its budget to be pruned before
+     * the next simulation.
+     */
+    bool full() const {
+        return nodes.size() > capacity / 4 * 3 || edges.size() > capacity / 4 * 3;
+    }
+
+    /**
+     * Frees half of the budget of the tree: the nodes with the fewest games
+     * forget their moves (they keep their own scores and list their moves
+     * again if the search comes back to them), so the subtrees below them
+     * are dropped, the least visited first. Call it between simulations:
+     * the indices of the nodes and the edges change.
+     */
+    void prune() {
+        for (float min_games = 2; nodes.size() > capacity / 2 || edges.size() > capacity / 2;
+             min_games *= 2)
+            compact(0, min_games);
+    }
+
+    /**
+     * The memory in use by the tree, in bytes.
+     */
+    size_t bytes() const {
+        return (nodes.size() + spare_nodes.size()) * sizeof(Node) +
+               (edges.size() + spare_edges.size()) * EdgeArrays::BYTES +
+               renumbered.size() * sizeof(uint32_t) + table.bytes();
+    }
+
+    /**
+     * Adds (or takes back, with a negative number) virtual losses to the
+     * edges of a path whose simulations are still running, so the next
+     * selections go elsewhere: games lost for the player choosing the move,
+     * the player at the root first.
+     */
+    void virtual_loss(const Path &path, double games) {
+        for (int i = 0; i < path.size(); ++i) {
+            edges.games[path[i]] += games;
+            if (i % 2 == 1)
+                edges.wins[path[i]] += games;
+        }
+    }
+
+    /**
+     * Adds the scores of a simulation to the root and to the edges (and
+     * their nodes) that the search went through.
+     * @param path The edges followed from the root.
+     */
+    void update(const Path &path, double total_g, double total_w) {
+        nodes[0].total_game += total_g;
+        for (int i = 0; i < path.size(); ++i) {
+            uint32_t e = path[i];
+            edges.games[e] += total_g;
+            edges.wins[e] += total_w;
+            if (edges.child[e] != NONE)
+                nodes[edges.child[e]].total_game += total_g;
+        }
+    }
+
+    /**
+     * Adds the AMAF scores of a simulation to the moves of the nodes on its
+     * path: a move gets the games where the player to move at its node put a
+     * stone on its point first, there or later.
+     * @param color The color (as in Position::stones) of the player at the
+     * root.
+     * @param amaf The games of the simulation; the moves of the path are
+     * marked in it.
+     */
+    void update_amaf(const Path &path, int color, Amaf &amaf, double total_g, double total_w) {
+        if (rave_equiv <= 0)
+            return;
+
+        uint32_t node[MAX_DEPTH];
+        node[0] = root();
+        for (int i = 1; i < path.size(); ++i)
+            node[i] = edges.child[path[i - 1]];
+        for (int i = path.size() - 1; i >= 0; --i) {
+            amaf.add_tree_move(color ^ (i & 1), edges.move[path[i]]);
+            add_amaf(node[i], color ^ (i & 1), amaf, total_g, total_w);
+        }
+    }
+
+    /**
+     * Adds the AMAF scores of a simulation to the moves of one node, see
+     * update_amaf.
+     * @param color The color of the player to move at the node.
+     */
+    void add_amaf(uint32_t node, int color, const Amaf &amaf, double total_g, double total_w) {
+        uint32_t first = nodes[node].first_edge;
+        for (uint32_t e = first; e < first + nodes[node].edge_num; ++e) {
+            double g, w;
+            if (amaf.scores(color, edges.move[e], total_g, total_w, g, w)) {
+                edges.amaf_games[e] += g;
+                edges.amaf_wins[e] += w;
+            }
+        }
+    }
+
+    /**
+     * The average of a move for the selection: its own average, blended with
+     * its AMAF one (RAVE) by a weight that starts at 1 and decays as the move
+     * gets games of its own.
+     * @param wins The wins of the move (its own, or with others added).
+     * @param games Its games, likewise.
+     */
+    double score(uint32_t e, double wins, double games) const {
+        if (rave_equiv <= 0 || edges.amaf_games[e] <= 0)
+            return wins / games;
+
+        double beta = sqrt(rave_equiv / (3 * games + rave_equiv));
+        return (1 - beta) * wins / games + beta * edges.amaf_wins[e] / edges.amaf_games[e];
+    }
+
+    /**
+     * Adds the scores of the moves of another tree of the same position to
+     * the root of this one. Used to merge the trees of root parallelization.
+     * @param min_games The moves of the other tree with fewer games are left
+     * out.
+     */
+    void merge_root(const Tree &other, float min_games = 0) {
+        copy_root_moves(other);
+        nodes[0].total_game += merge_root_shard(&other, 1, 0, 1, min_games);
+    }
+
+    /**
+     * Lists the moves of the root of another tree of the same position, with
+     * no scores, if the root of this one has none yet: the first step of
+     * merging trees with merge_root_shard.
+     */
+    void copy_root_moves(const Tree &other) {
+        const Node &r = other.nodes[0];
+        if (expanded(0))
+            return;
+
+        nodes[0].first_edge = edges.size();
+        nodes[0].edge_num = r.edge_num;
+        for (int j = 0; j < r.edge_num; ++j) {
+            Edge e = other.edges.at(r.first_edge + j);
+            e.child = NONE;
+            e.total_game = 0;
+            e.total_win = 0;
+            e.amaf_game = 0;
+            e.amaf_win = 0;
+            edges.push_back(e);
+        }
+    }
+
+    /**
+     * Adds the scores of a shard of the moves of the root of several trees
+     * to the moves of the root of this one (listed by copy_root_moves). The
+     * shards are disjoint, so every thread can merge its own at the same
+     * time, and the merge takes 1 / shard_num of the time of one thread.
+     * @param trees The trees, all rooted at the position of this one.
+     * @param shard The shard of this call, in [0, shard_num).
+     * @param min_games The moves of a tree with fewer games are left out.
+     * @returns The games added, which the caller adds to the root.
+     */
+    double merge_root_shard(const Tree *trees, int tree_num, int shard, int shard_num,
+                          float min_games = 0) {
+        int edge_num = nodes[0].edge_num;
+        int first = (long)edge_num * shard / shard_num;
+        int last = (long)edge_num * (shard + 1) / shard_num;
+        uint32_t e = nodes[0].first_edge;
+        double games = 0;
+
+        for (int i = 0; i < tree_num; ++i) {
+            const Node &r = trees[i].nodes[0];
+            const EdgeArrays &o = trees[i].edges;
+            if (r.edge_num != edge_num)
+                continue;   // A tree that did not search
+
+            for (int j = first; j < last; ++j) {
+                uint32_t f = r.first_edge + j;
+                if (o.games[f] < min_games || o.games[f] == 0)
+                    continue;
+                edges.games[e + j] += o.games[f];
+                edges.wins[e + j] += o.wins[f];
+                edges.amaf_games[e + j] += o.amaf_games[f];
+                edges.amaf_wins[e + j] += o.amaf_wins[f];
+                games += o.games[f];
+            }
+        }
+        return games;
+    }
+
+    /**
+     * Writes the scores of the moves of the root, games and wins of every
+     * move in turn, e.g. to add up the trees of several processes.
+     * @returns The number of moves.
+     */
+    int root_scores(float *scores) const {
+        const Node &r = nodes[0];
+        for (int j = 0; j < r.edge_num; ++j) {
+            scores[2 * j] = edges.games[r.first_edge + j];
+            scores[2 * j + 1] = edges.wins[r.first_edge + j];
+        }
+        return r.edge_num;
+    }
+
+    /**
+     * Writes the scores of the moves of the root, AMAF scores included.
+     * @returns The number of moves.
+     */
+    int root_scores(RootScore *scores) const {
+        const Node &r = nodes[0];
+        for (int j = 0; j < r.edge_num; ++j) {
+            uint32_t e = r.first_edge + j;
+            scores[j].games = edges.games[e];
+            scores[j].wins = edges.wins[e];
+            scores[j].amaf_games = edges.amaf_games[e];
+            scores[j].amaf_wins = edges.amaf_wins[e];
+        }
+        return r.edge_num;
+    }
+
+    /**
+     * The move of the root that the rest of the search cannot change, see
+     * decided_move.
+     * @returns Its place among the moves of the root, -1 while the search
+     * should go on.
+     */
+    int decided(double played, double done, bool maximize, double in_flight = 0) const {
+        RootScore scores[AMAF_POINTS];
+        int move_num = root_scores(scores);
+        return decided_move(scores, move_num, rave_equiv, played, done, in_flight, maximize);
+    }
+
+    /**
+     * Replaces the scores of the moves of the root, as given by root_scores.
+     */
+    void set_root_scores(const float *scores) {
+        Node &r = nodes[0];
+        r.total_game = 0;
+        for (int j = 0; j < r.edge_num; ++j) {
+            edges.games[r.first_edge + j] = scores[2 * j];
+            edges.wins[r.first_edge + j] = scores[2 * j + 1];
+            r.total_game += scores[2 * j];
+        }
+    }
+
+    /**
+     * Returns the move of the root with the best average score (see score:
+     * with RAVE, a move played a few times is judged mostly by its AMAF
+     * average, not by the luck of its few games), among the ones that were
+     * played.
+     * @param maximize False when the scores are the ones of the other player:
+     * the best move is then the one with the lowest average.
+     */
+    int best_move(bool maximize = true) const {
+        const Node &r = nodes[0];
+        double average = -10.0;
+        int move = -1;
+
+        for (int j = 0; j < r.edge_num; ++j) {
+            uint32_t e = r.first_edge + j;
+            if (edges.games[e] <= 0)
+                continue;
+
+            double tmp = maximize ? score(e, edges.wins[e], edges.games[e])
+                                  : -score(e, edges.wins[e], edges.games[e]);
+            if (average < tmp) {
+                average = tmp;
+                move = edges.move[e];
+            }
+        }
+        return move;
+    }
+
+private:
+    size_t capacity;    // The most nodes, and the most edges, of the tree
+
+    /* The arrays the nodes are compacted into by advance and prune */
+    std::vector<Node> spare_nodes;
+    EdgeArrays spare_edges;
+    std::vector<uint32_t> renumbered;
+
+    /* Whether the arrays can take more nodes and edges, reserving them the
+       first time, so they never move once the tree grows */
+    bool room(size_t node_num, size_t edge_num) {
+        if (nodes.size() + node_num > capacity || edges.size() + edge_num > capacity)
+            return false;
+        if (edges.capacity() < capacity) {
+            nodes.reserve(capacity);
+            edges.reserve(capacity);
+        }
+        return true;
+    }
+
+    /**
+     * Makes a node the root and keeps only the nodes that can be reached from
+     * it, copied in breadth-first order to the spare arrays that then swap
+     * with the live ones.
+     * @param min_games The nodes with fewer games (the root aside) are kept
+     * without their moves.
+     */
+    void compact(uint32_t root, float min_games) {
+        spare_nodes.reserve(capacity);
+        spare_edges.reserve(capacity);
+        renumbered.reserve(capacity);
+        renumbered.assign(nodes.size(), (uint32_t)TranspositionTable::UNSEEN);
+        spare_nodes.clear();
+        spare_edges.clear();
+
+        renumbered[root] = 0;
+        spare_nodes.push_back(nodes[root]);
+        for (size_t i = 0; i < spare_nodes.size(); ++i) {
+            const Node n = spare_nodes[i];
+            spare_nodes[i].first_edge = spare_edges.size();
+            if (i != 0 && n.total_game < min_games) {
+                spare_nodes[i].edge_num = 0;
+                continue;
+            }
+
+            for (int j = 0; j < n.edge_num; ++j) {
+                Edge e = edges.at(n.first_edge + j);
+                if (e.child != NONE) {
+                    if (renumbered[e.child] == TranspositionTable::UNSEEN) {
+                        renumbered[e.child] = spare_nodes.size();
+                        spare_nodes.push_back(nodes[e.child]);
+                    }
+                    // An edge back to the root becomes a new leaf
+                    e.child = renumbered[e.child];
+                }
+                spare_edges.push_back(e);
+            }
+        }
+
+        nodes.swap(spare_nodes);
+        edges.swap(spare_edges);
+        table.renumber(renumbered);
+    }
+
+    bool same_moves(uint32_t node, const int *moves, int move_num) const {
+        const Node &n = nodes[node];
+        if (n.edge_num == 0)
+            return true;
+        if (n.edge_num != move_num)
+            return false;
+        for (int j = 0; j < move_num; ++j)
+            if (edges.move[n.first_edge + j] != moves[j])
+                return false;
+        return true;
+    }
+};
+
+/**
+ * The memory budget of every tree of a process that keeps tree_num of them,
+ * so that all of them together stay within PROCESS_MAX_MB whatever the
+ * number of threads.
+ */
+inline size_t tree_budget(int tree_num) {
+    return ((size_t)PROCESS_MAX_MB << 20) / (tree_num > 0 ? tree_num : 1);
+}
+
+/**
+ * The part of the search of one thread that is not in a base tree shared by
+ * all the threads: the base stays read-only during the search, and every
+ * thread keeps its own scores of the base moves and nodes it goes through,
+ * in a small hash table, and its own tree of the nodes it adds below the
+ * leaves of the base. Only these are merged into the base after the search
+ * (see merge_into), so no thread copies the base. The nodes and edges are
+ * the ones of the base, or the ones of the own tree with the OVERLAY bit;
+ * the interface is the one of Tree.
+ */
+class Overlay {
+public:
+    static const uint32_t NONE = 0;
+    static const uint32_t OVERLAY = 0x80000000;
+
+    Tree tree;  // The nodes below the leaves of the base (node 0 unused)
+
+    /**
+     * @param max_bytes The memory budget of the overlay: half of it for its
+     * tree, half for the scores of the base moves.
+     */
+    Overlay(size_t max_bytes = (size_t)PROCESS_MAX_MB << 20)
+        : tree(max_bytes / 2), base(NULL), used(0), bits(0),
+          max_deltas(max_bytes / 2 / sizeof(Delta)) {
+    }
+
+    /**
+     * Starts a search of a base tree, forgetting the previous one.
+     */
+    void begin(const Tree &b) {
+        base = &b;
+        tree.clear();
+        keys.clear();
+        if (deltas.empty())
+            resize(10);
+        for (size_t i = 0; i < deltas.size(); ++i)
+            deltas[i].key = EMPTY;
+        used = 0;
+    }
+
+    uint32_t root() const {
+        return 0;
+    }
+
+    bool expanded(uint32_t node) const {
+        if (node & OVERLAY)
+            return tree.expanded(node & ~OVERLAY);
+        if (base->expanded(node))
+            return true;
+        const Delta *d = find(node | NODE_KEY);
+        return d && d->child != NONE && tree.expanded(d->child);
+    }
+
+    int move(uint32_t edge) const {
+        if (edge & OVERLAY)
+            return tree.move(edge & ~OVERLAY);
+        return base->move(edge);
+    }
+
+    uint32_t child(uint32_t edge) const {
+        if (edge & OVERLAY) {
+            uint32_t c = tree.child(edge & ~OVERLAY);
+            return c == NONE ? NONE : c | OVERLAY;
+        }
+        if (base->child(edge) != NONE)
+            return base->child(edge);
+        const Delta *d = find(edge);
+        return d && d->child != NONE ? d->child | OVERLAY : NONE;
+    }
+
+    /**
+     * Lists the moves of a node, in the own tree: a leaf of the base gets a
+     * node there that stands in for it.
+     */
+    bool expand(uint32_t node, const int *moves, int move_num) {
+        if (node & OVERLAY)
+            return tree.expand(node & ~OVERLAY, moves, move_num);
+
+        Delta &d = entry(node | NODE_KEY);
+        if (&d == &spill)
+            return false;  // The scores are full, as the tree would be
+        if (d.child == NONE)
+            d.child = tree.add_node();
+        return d.child != NONE && tree.expand(d.child, moves, move_num);
+    }
+
+    /**
+     * Chooses the edge to follow, as Tree::select, with the scores of the
+     * base and of this thread added up.
+     */
+    uint32_t select(uint32_t node, bool maximize) {
+        if (node & OVERLAY)
+            return tree.select(node & ~OVERLAY, maximize) | OVERLAY;
+        if (!base->expanded(node))
+            return tree.select(find(node | NODE_KEY)->child, maximize) | OVERLAY;
+
+        const Node &n = base->nodes[node];
+        const Delta *dn = find(node | NODE_KEY);
+        float T = n.total_game + (dn ? dn->games : 0);
+        float least = base->least_prior(n.first_edge, n.edge_num, T, maximize);
+        float c = UCB_Z * log(T > 1 ? T : 1);
+        float ucb = -INFINITY;
+        int best = 0;
+
+        for (int j = 0; j < n.edge_num; ++j) {
+            uint32_t e = n.first_edge + j;
+            if (base->prior(e, j, maximize) < least)
+                continue;
+
+            const Delta *d = find(e);
+            float pj = base->edges.wins[e] + (d ? d->wins : 0);
+            float nj = base->edges.games[e] + (d ? d->games : 0);
+            float tmp_ucb = base->urgency(e, pj, nj, c, maximize);
+
+            if (ucb < tmp_ucb) {
+                ucb = tmp_ucb;
+                best = j;
+            }
+        }
+        return n.first_edge + best;
+    }
+
+    /**
+     * Adds the node at the end of an edge to the own tree.
+     * @returns The node, NONE when the overlay has no room left.
+     */
+    uint32_t add_child(uint32_t edge, uint64_t key, const Path &) {
+        Delta *d = edge & OVERLAY ? NULL : &entry(edge);
+        if (d == &spill)
+            return NONE;
+        uint32_t node = tree.add_node();
+        if (node == NONE)
+            return NONE;
+        keys.push_back(std::make_pair(node, key));
+
+        if (d)
+            d->child = node;
+        else
+            tree.edges.child[edge & ~OVERLAY] = node;
+        return node | OVERLAY;
+    }
+
+    /**
+     * Adds the scores of a simulation, as Tree::update.
+     */
+    void update(const Path &path, double total_g, double total_w) {
+        add_games(0, total_g);
+        for (int i = 0; i < path.size(); ++i) {
+            if (path[i] & OVERLAY) {
+                uint32_t e = path[i] & ~OVERLAY;
+                tree.edges.games[e] += total_g;
+                tree.edges.wins[e] += total_w;
+                if (tree.edges.child[e] != NONE)
+                    tree.nodes[tree.edges.child[e]].total_game += total_g;
+                continue;
+            }
+
+            Delta &d = entry(path[i]);
+            d.games += total_g;
+            d.wins += total_w;
+            uint32_t own_child = d.child;
+
+            if (base->child(path[i]) != NONE)
+                add_games(base->child(path[i]), total_g);
+            else if (own_child != NONE)
+                tree.nodes[own_child].total_game += total_g;
+        }
+    }
+
+    /**
+     * Adds the AMAF scores of a simulation, as Tree::update_amaf, to the
+     * nodes of the own tree on its path (the base keeps its own).
+     */
+    void update_amaf(const Path &path, int color, Amaf &amaf, double total_g, double total_w) {
+        if (tree.rave_equiv <= 0)
+            return;
+
+        uint32_t node[MAX_DEPTH];
+        node[0] = root();
+        for (int i = 1; i < path.size(); ++i)
+            node[i] = child(path[i - 1]);
+        for (int i = path.size() - 1; i >= 0; --i) {
+            amaf.add_tree_move(color ^ (i & 1), move(path[i]));
+            uint32_t own = own_node(node[i]);
+            if (own != NONE)
+                tree.add_amaf(own, color ^ (i & 1), amaf, total_g, total_w);
+        }
+    }
+
+    /* The overlay only lives for one search: its tree stops growing when it
+       is full */
+    bool full() const {
+        return false;
+    }
+
+    void prune() {
+    }
+
+    /**
+     * Adds the scores of this thread to the base and moves its nodes there,
+     * below the leaves of the base that are still leaves (when two threads
+     * grew the same leaf, the nodes of the first one merged are kept, and
+     * only the scores of the others). Call it for one thread at a time.
+     * @param b The base, the tree given to begin.
+     */
+    void merge_into(Tree &b) {
+        copied.assign(tree.nodes.size(), (uint32_t)TranspositionTable::UNSEEN);
+
+        for (size_t i = 0; i < deltas.size(); ++i) {
+            const Delta &d = deltas[i];
+            if (d.key == EMPTY || d.child == NONE)
+                continue;
+
+            if (d.key & NODE_KEY) {
+                uint32_t node = d.key & ~NODE_KEY;
+                if (!b.expanded(node)) {
+                    copied[d.child] = node;
+                    b.graft(node, tree, d.child, copied);
+                }
+            } else if (b.edges.child[d.key] == NONE) {
+                uint32_t node = b.add_node();
+                if (node != NONE) {
+                    copied[d.child] = node;
+                    b.nodes[node].total_game = tree.nodes[d.child].total_game;
+                    b.graft(node, tree, d.child, copied);
+                    b.edges.child[d.key] = node;
+                }
+            } else {
+                b.nodes[b.edges.child[d.key]].total_game += tree.nodes[d.child].total_game;
+            }
+        }
+
+        for (size_t i = 0; i < deltas.size(); ++i) {
+            const Delta &d = deltas[i];
+            if (d.key == EMPTY)
+                continue;
+
+            if (d.key & NODE_KEY) {
+                b.nodes[d.key & ~NODE_KEY].total_game += d.games;
+            } else {
+                b.edges.games[d.key] += d.games;
+                b.edges.wins[d.key] += d.wins;
+            }
+        }
+
+        for (size_t i = 0; i < keys.size(); ++i)
+            if (copied[keys[i].first] != TranspositionTable::UNSEEN)
+                b.table.insert(keys[i].second, copied[keys[i].first], b.nodes);
+    }
+
+    /**
+     * The move of the root that the rest of the search cannot change, as
+     * Tree::decided, with the scores of the base and of this thread added
+     * up (the AMAF scores of the root are the ones of the base).
+     * @returns Its place among the moves of the root, -1 while the search
+     * should go on (and while the base has no moves).
+     */
+    int decided(double played, double done, bool maximize, double in_flight = 0) const {
+        RootScore scores[AMAF_POINTS];
+        const Node &r = base->nodes[0];
+        for (int j = 0; j < r.edge_num; ++j) {
+            uint32_t e = r.first_edge + j;
+            const Delta *d = find(e);
+            scores[j].games = base->edges.games[e] + (d ? d->games : 0);
+            scores[j].wins = base->edges.wins[e] + (d ? d->wins : 0);
+            scores[j].amaf_games = base->edges.amaf_games[e];
+            scores[j].amaf_wins = base->edges.amaf_wins[e];
+        }
+        return decided_move(scores, r.edge_num, base->rave_equiv, played, done, in_flight,
+                            maximize);
+    }
+
+    /**
+     * The memory of the overlay, in bytes (its tree has no transposition
+     * table: the keys of its nodes go to the one of the base).
+     */
+    size_t bytes() const {
+        return tree.nodes.size() * sizeof(Node) + tree.edges.size() * EdgeArrays::BYTES +
+               deltas.size() * sizeof(Delta) + keys.size() * sizeof(keys[0]);
+    }
+
+private:
+    /* The scores of this thread of a base edge, or of a base node (with the
+       NODE_KEY bit), and the node of the own tree below it */
+    struct Delta {
+        uint32_t key;
+        uint32_t child;
+        float games;
+        float wins;
+    };
+
+    static const uint32_t EMPTY = 0xffffffff;
+    static const uint32_t NODE_KEY = 0x80000000;
+
+    const Tree *base;
+    std::vector<Delta> deltas;  // Open addressing, at most half full
+    size_t used;
+    int bits;
+    size_t max_deltas;  // The most entries the budget gives
+    Delta spill;  // What entry returns once the scores are full: they are lost
+    std::vector<std::pair<uint32_t, uint64_t> > keys;  // Of the own nodes
+    std::vector<uint32_t> copied;
+
+    size_t slot(uint32_t key) const {
+        return (uint32_t)(key * 2654435761u) >> (32 - bits);
+    }
+
+    const Delta *find(uint32_t key) const {
+        size_t mask = deltas.size() - 1;
+        for (size_t i = slot(key);; i = (i + 1) & mask) {
+            if (deltas[i].key == key)
+                return &deltas[i];
+            if (deltas[i].key == EMPTY)
+                return NULL;
+        }
+    }
+
+    /* The entry of a key, added if needed (which may move the others), or
+       the spill once the table is at its budget */
+    Delta &entry(uint32_t key) {
+        size_t mask = deltas.size() - 1;
+        size_t i = slot(key);
+        for (; deltas[i].key != EMPTY; i = (i + 1) & mask)
+            if (deltas[i].key == key)
+                return deltas[i];
+
+        if (2 * (used + 1) > deltas.size()) {
+            if (2 * deltas.size() > max_deltas) {
+                spill.key = EMPTY;
+                spill.child = NONE;
+                spill.games = 0;
+                spill.wins = 0;
+                return spill;
+            }
+            resize(bits + 1);
+            return entry(key);
+        }
+        used++;
+        deltas[i].key = key;
+        deltas[i].child = NONE;
+        deltas[i].games = 0;
+        deltas[i].wins = 0;
+        return deltas[i];
+    }
+
+    void resize(int new_bits) {
+        std::vector<Delta> old;
+        old.swap(deltas);
+        bits = new_bits;
+
+        Delta empty;
+        empty.key = EMPTY;
+        deltas.assign((size_t)1 << bits, empty);
+        used = 0;
+        for (size_t i = 0; i < old.size(); ++i)
+            if (old[i].key != EMPTY)
+                entry(old[i].key) = old[i];
+    }
+
+    /* The node of the own tree of a node: itself, or the one that stands in
+       for a leaf of the base; NONE for the other nodes of the base */
+    uint32_t own_node(uint32_t node) const {
+        if (node & OVERLAY)
+            return node & ~OVERLAY;
+        if (base->expanded(node))
+            return NONE;
+        const Delta *d = find(node | NODE_KEY);
+        return d ? d->child : NONE;
+    }
+
+    /* Adds games to a base node */
+    void add_games(uint32_t node, double games) {
+        Delta &d = entry(node | NODE_KEY);
+        d.games += games;
+        if (d.child != NONE)
+            tree.nodes[d.child].total_game += games;
+    }
+};
+
+/**
+ * A move of a node of the shared tree, see Edge. The scores are updated by
+ * several threads at once.
+ */
+struct SharedEdge {
+    int16_t move;
+    std::atomic<uint32_t> child;
+    std::atomic<float> total_game;
+    std::atomic<float> total_win;
+};
+
+/**
+ * A node of the shared tree, see Node. The thread that lists the moves first
+ * claims the node (EXPANDING), then publishes them (EXPANDED).
+ */
+struct SharedNode {
+    enum { UNEXPANDED, EXPANDING, EXPANDED };
+
+    std::atomic<uint32_t> state;
+    uint32_t first_edge;
+    uint16_t edge_num;
+    std::atomic<float> total_game;
+};
+
+/**
+ * The search tree of tree parallelization: every thread searches the same
+ * tree, without locks. The nodes and the edges are taken from two arrays,
+ * sized by the memory budget and allocated once, by atomic counters, so
+ * growing the tree never moves it; a tree that is full stops growing and the
+ * search simulates from its leaves. The scores are added atomically, and a
+ * thread going down an edge adds a virtual loss to it (games lost for the
+ * player choosing the move) until its simulation is back, so the other
+ * threads spread over the other moves. A position reached by several orders
+ * of moves is several nodes here.
+ */
+class SharedTree {
+public:
+    static const uint32_t NONE = 0;     // The root is never a child
+
+    SharedEdge *edges;
+
+    /**
+     * @param max_bytes The memory budget of the tree, the whole one of the
+     * process by default.
+     */
+    SharedTree(size_t max_bytes = (size_t)PROCESS_MAX_MB << 20) {
+        capacity = max_bytes / (sizeof(SharedNode) + sizeof(SharedEdge));
+        nodes = new SharedNode[capacity];
+        edges = new SharedEdge[capacity];
+        clear();
+    }
+
+    ~SharedTree() {
+        delete[] nodes;
+        delete[] edges;
+    }
+
+    /**
+     * Drops every node but an empty root. Not thread safe: call it between
+     * two searches.
+     */
+    void clear() {
+        node_count.store(1);
+        edge_count.store(0);
+        init(0);
+    }
+
+    uint32_t root() const {
+        return 0;
+    }
+
+    bool expanded(uint32_t node) const {
+        return nodes[node].state.load(std::memory_order_acquire) == SharedNode::EXPANDED;
+    }
+
+    /**
+     * Lists the moves of a node, unless another thread is listing them.
+     * @param moves The moves (points, -1 for the pass), see get_next_moves.
+     * @returns False when the node is not expanded by this call (another
+     * thread is at it, or the tree is full): it stays a leaf for now.
+     */
+    bool expand(uint32_t node, const int *moves, int move_num) {
+        SharedNode &n = nodes[node];
+        uint32_t state = SharedNode::UNEXPANDED;
+        if (!n.state.compare_exchange_strong(state, SharedNode::EXPANDING))
+            return state == SharedNode::EXPANDED;
+
+        uint32_t first = edge_count.fetch_add(move_num);
+        if (first + move_num > capacity) {
+            n.state.store(SharedNode::UNEXPANDED);
+            return false;
+        }
+
+        for (int i = 0; i < move_num; ++i) {
+            SharedEdge &e = edges[first + i];
+            e.move = moves[i];
+            e.child.store(NONE, std::memory_order_relaxed);
+            e.total_game.store(0, std::memory_order_relaxed);
+            e.total_win.store(0, std::memory_order_relaxed);
+        }
+        n.first_edge = first;
+        n.edge_num = move_num;
+        n.state.store(SharedNode::EXPANDED, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Chooses the edge to follow from an expanded node, as Tree::select, and
+     * adds a virtual loss to it: the best one by UCB among the moves open at
+     * the node, a move never tried getting the urgency of FPU. The tree keeps
+     * no AMAF scores, so the moves open are the first ones of the list of the
+     * node (see Tree::least_prior and get_next_moves).
+     * @param maximize True when the player at the root is to move.
+     * @returns The index of the edge.
+     */
+    uint32_t select(uint32_t node, bool maximize) {
+        const SharedNode &n = nodes[node];
+        SharedEdge *e = &edges[n.first_edge];
+        int edge_num = n.edge_num;
+
+        // The games of the node may still be 0 while its edges only hold
+        // virtual losses
+        double T = n.total_game.load(std::memory_order_relaxed);
+        if (WIDEN_BASE > 0) {
+            double open = WIDEN_BASE + pow(T, WIDEN_EXPONENT);
+            if (open < edge_num)
+                edge_num = (int)open;
+        }
+        double c = UCB_Z * log(T > 1 ? T : 1);
+        double ucb = -INFINITY;
+        int best = 0;
+
+        // As Tree::urgency: the best move has the highest value for both
+        // players
+        for (int j = 0; j < edge_num; ++j) {
+            double nj = e[j].total_game.load(std::memory_order_relaxed);
+            double tmp_ucb = maximize ? FPU : FPU - 1;
+            if (nj > 0) {
+                double average = e[j].total_win.load(std::memory_order_relaxed) / nj;
+                tmp_ucb = sqrt(c / nj) + (maximize ? average : -average);
+            }
+
+            if (ucb < tmp_ucb) {
+                ucb = tmp_ucb;
+                best = j;
+            }
+        }
+
+        add(e[best].total_game, VIRTUAL_LOSS);
+        if (!maximize)
+            add(e[best].total_win, VIRTUAL_LOSS);
+        return n.first_edge + best;
+    }
+
+    /**
+     * Returns the node at the end of an edge, made if no thread made it yet.
+     * @returns The node, NONE when the tree is full.
+     */
+    uint32_t add_child(uint32_t edge) {
+        uint32_t child = edges[edge].child.load(std::memory_order_acquire);
+        if (child != NONE)
+            return child;
+
+        uint32_t node = node_count.fetch_add(1);
+        if (node >= capacity)
+            return NONE;
+        init(node);
+
+        // The thread that loses the race uses the node of the winner (its
+        // own one is not used again until the tree is cleared)
+        if (!edges[edge].child.compare_exchange_strong(child, node, std::memory_order_acq_rel))
+            return child;
+        return node;
+    }
+
+    /**
+     * Adds the scores of a simulation to the root and to the edges (and
+     * their nodes) that the search went through, taking back the virtual
+     * losses of select. The player to choose alternates along the path,
+     * the player at the root first.
+     * @param path The edges followed from the root.
+     */
+    void update(const Path &path, double total_g, double total_w) {
+        add(nodes[0].total_game, total_g);
+        for (int i = 0; i < path.size(); ++i) {
+            SharedEdge &e = edges[path[i]];
+            add(e.total_game, total_g - VIRTUAL_LOSS);
+            add(e.total_win, i % 2 == 0 ? total_w : total_w - VIRTUAL_LOSS);
+
+            uint32_t child = e.child.load(std::memory_order_acquire);
+            if (child != NONE)
+                add(nodes[child].total_game, total_g);
+        }
+    }
+
+    /**
+     * Returns the move of the root with the best average score, among the
+     * ones that were played.
+     */
+    int best_move() const {
+        const SharedNode &r = nodes[0];
+        double average = -10.0;
+        int move = -1;
+
+        if (!expanded(0))
+            return move;
+        for (int j = 0; j < r.edge_num; ++j) {
+            const SharedEdge &e = edges[r.first_edge + j];
+            double games = e.total_game.load();
+            if (games > 0 && average < e.total_win.load() / games) {
+                average = e.total_win.load() / games;
+                move = e.move;
+            }
+        }
+        return move;
+    }
+
+    /**
+     * Writes the scores of the moves of the root, as Tree::root_scores.
+     * @returns The number of moves.
+     */
+    int root_scores(float *scores) const {
+        const SharedNode &r = nodes[0];
+        if (!expanded(0))
+            return 0;
+        for (int j = 0; j < r.edge_num; ++j) {
+            scores[2 * j] = edges[r.first_edge + j].total_game.load();
+            scores[2 * j + 1] = edges[r.first_edge + j].total_win.load();
+        }
+        return r.edge_num;
+    }
+
+    /**
+     * The move of the root that the rest of the search cannot change, as
+     * Tree::decided (the tree keeps no AMAF scores, so best_move and
+     * decided_move judge by the averages alone).
+     * @param in_flight The virtual losses that the other threads may have
+     * on a move of the root.
+     */
+    int decided(double played, double done, bool maximize, double in_flight) const {
+        RootScore scores[AMAF_POINTS];
+        const SharedNode &r = nodes[0];
+        if (!expanded(0))
+            return -1;
+        for (int j = 0; j < r.edge_num; ++j) {
+            scores[j].games = edges[r.first_edge + j].total_game.load();
+            scores[j].wins = edges[r.first_edge + j].total_win.load();
+            scores[j].amaf_games = 0;
+            scores[j].amaf_wins = 0;
+        }
+        return decided_move(scores, r.edge_num, 0, played, done, in_flight, maximize);
+    }
+
+    /**
+     * The number of nodes of the tree.
+     */
+    size_t size() const {
+        size_t n = node_count.load();
+        return n < capacity ? n : capacity;
+    }
+
+    /**
+     * The memory in use by the tree, in bytes.
+     */
+    size_t bytes() const {
+        size_t e = edge_count.load();
+        return size() * sizeof(SharedNode) + (e < capacity ? e : capacity) * sizeof(SharedEdge);
+    }
+
+private:
+    SharedNode *nodes;
+    size_t capacity;    // The most nodes, and the most edges, of the tree
+    std::atomic<uint32_t> node_count;
+    std::atomic<uint32_t> edge_count;
+
+    SharedTree(const SharedTree &) = delete;
+    SharedTree &operator=(const SharedTree &) = delete;
+
+    void init(uint32_t node) {
+        nodes[node].first_edge = 0;
+        nodes[node].edge_num = 0;
+        nodes[node].total_game.store(0, std::memory_order_relaxed);
+        nodes[node].state.store(SharedNode::UNEXPANDED, std::memory_order_release);
+    }
+
+    /* There is no fetch_add for floats before C++20 */
+    static void add(std::atomic<float> &a, double x) {
+        float old = a.load(std::memory_order_relaxed);
+        while (!a.compare_exchange_weak(old, old + (float)x, std::memory_order_relaxed))
+            ;
+    }
+};
+
+/**
+ * The clock of a player for a whole game: a main time, then a byo-yomi
+ * period for every move (0 for sudden death). The time of a move is its
+ * share of the main time left, over the moves the player is expected to have
+ * left (TM_MOVES_PER_POINT per empty point), scaled by how the search of its
+ * previous move ended: less when the best move was decided (its average past
+ * TM_DECIDED, won or lost), more when it was close (a second move with
+ * TM_CLOSE of its games), none when there is one move only. A move never
+ * takes more than TM_MAX_SHARE of the main time left, and the time the
+ * searches overran their budget by is kept off it, so the clock is not run
+ * out over the game.
+ */
+class TimeManager {
+public:
+    /**
+     * @param main_time The main time of the player, in seconds.
+     * @param byo_yomi The time of every move once it is spent.
+     */
+    TimeManager(double main_time, double byo_yomi)
+        : left(main_time), byo_yomi(byo_yomi), scale(1), lag(0), budget(0), start(0),
+          searched(false), overtime(0) {
+    }
+
+    /**
+     * Starts the clock of a move.
+     * @param s The position, the player of the clock to move.
+     * @returns The time of the search, in seconds.
+     */
+    template <class P>
+    double start_move(const P &s) {
+        start = now();
+        searched = !s.is_pass();
+        int move_num = searched ? s.legal_moves().count() : 0;
+        if (move_num <= 1)
+            return budget = 0;
+
+        double moves_left = s.empty.count() * TM_MOVES_PER_POINT;
+        if (moves_left < TM_MIN_MOVES)
+            moves_left = TM_MIN_MOVES;
+        budget = left / moves_left * scale;
+        if (budget > left * TM_MAX_SHARE)
+            budget = left * TM_MAX_SHARE;
+        if (budget < byo_yomi * TM_BYO_YOMI_USE)
+            budget = byo_yomi * TM_BYO_YOMI_USE;
+        budget = budget > lag ? budget - lag : 0;
+        return budget;
+    }
+
+    /**
+     * Stops the clock of a move, spends its time and judges the search.
+     * @param tree The tree searched, its root the position of the move.
+     * @param maximize False when the scores of the tree are the ones of the
+     * other player.
+     */
+    template <class T>
+    void end_move(const T &tree, bool maximize) {
+        double seconds = now() - start;
+        if (lag < seconds - budget)
+            lag = seconds - budget;
+        if (seconds <= left) {
+            left -= seconds;
+        } else {
+            if (seconds - left > byo_yomi)
+                overtime++;
+            left = 0;
+        }
+
+        if (searched) {
+            float scores[2 * AMAF_POINTS];
+            judge(scores, tree.root_scores(scores), maximize);
+        }
+    }
+
+    /**
+     * The main time left, in seconds.
+     */
+    double main_left() const {
+        return left;
+    }
+
+    /**
+     * The moves that took longer than the clock had left.
+     */
+    int over_time() const {
+        return overtime;
+    }
+
+private:
+    double left;        // The main time left
+    double byo_yomi;
+    double scale;       // The share of the next move, see judge
+    double lag;         // The most a search ran past its budget
+    double budget;      // The budget of the move being played
+    double start;
+    bool searched;
+    int overtime;
+
+    static double now() {
+        struct timeval tp;
+        gettimeofday(&tp, NULL);
+        return tp.tv_sec + tp.tv_usec / 1000000.0;
+    }
+
+    /* Scales the share of the next move by how the search ended: the games
+       and the wins of every move of the root */
+    void judge(const float *scores, int move_num, bool maximize) {
+        float most = 0, second = 0;
+        int best = -1;
+        for (int j = 0; j < move_num; ++j) {
+            if (scores[2 * j] > most) {
+                second = most;
+                most = scores[2 * j];
+                best = j;
+            } else if (scores[2 * j] > second) {
+                second = scores[2 * j];
+            }
+        }
+
+        scale = 1;
+        if (best < 0)
+            return;
+        double average = scores[2 * best + 1] / most;
+        if (!maximize)
+            average = 1 - average;
+        if (average > TM_DECIDED || average < 1 - TM_DECIDED)
+            scale = TM_DECIDED_SCALE;
+        else if (second > most * TM_CLOSE)
+            scale = TM_CLOSE_SCALE;
+    }
+};
+
+/**
+ * The early stop of the threads of root parallelization: every thread votes
+ * for the move of the root its own tree has decided (see decided_move), or
+ * for none (-1), and the search stops when they all vote for the same move,
+ * which is then the move played: each tree decided it, while the merged
+ * root may judge differently. The votes and the stop are atomic, so any
+ * thread can check them at any time.
+ */
+class StopVote {
+public:
+    /**
+     * Starts a search, with no votes. Call it before the threads start.
+     */
+    void begin(int thread_num) {
+        if (votes.size() != (size_t)thread_num)
+            std::vector<std::atomic<int> >(thread_num).swap(votes);
+        for (int i = 0; i < thread_num; ++i)
+            votes[i].store(-1, std::memory_order_relaxed);
+        stopped.store(-1);
+    }
+
+    void vote(int thread, int move) {
+        votes[thread].store(move, std::memory_order_relaxed);
+    }
+
+    /**
+     * The move every thread votes for, -1 when they do not agree.
+     */
+    int agreed() const {
+        int move = votes[0].load(std::memory_order_relaxed);
+        for (size_t i = 1; i < votes.size() && move >= 0; ++i)
+            if (votes[i].load(std::memory_order_relaxed) != move)
+                move = -1;
+        return move;
+    }
+
+    /**
+     * Stops the search on a move agreed on; the first one stays.
+     */
+    void stop(int move) {
+        int none = -1;
+        stopped.compare_exchange_strong(none, move);
+    }
+
+    bool stop_now() const {
+        return stopped.load() >= 0;
+    }
+
+    /**
+     * The move the search stopped on, -1 when it did not stop early.
+     */
+    int move() const {
+        return stopped.load();
+    }
+
+private:
+    std::vector<std::atomic<int> > votes;
+    std::atomic<int> stopped;
+};
+
+#endif
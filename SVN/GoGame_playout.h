@@ -0,0 +1,154 @@
+#ifndef GOGAME_PLAYOUT_H
+#define GOGAME_PLAYOUT_H
+
+#include <cstdint>
+
+#include "GoGame_position.h"
+
+#define PLAYOUT_FILL_EYES   0   // 1 = Uniform over all legal moves
+#define PLAYOUT_MAX_MOVES   3   // Times the points of the board, then score
+
+/**
+ * A xoshiro256** generator. Every thread (and every MPI process) owns one, so
+ * the simulations share no random state.
+ */
+class Random {
+public:
+    /**
+     * @param seed The seed shared by all the threads (e.g. the time).
+     * @param stream The index of the thread: the generator is the one of the
+     * seed, jumped ahead 2^192 steps for every stream, so no two threads ever
+     * draw the same sequence.
+     */
+    Random(uint64_t seed = 0, int stream = 0) {
+        for (int i = 0; i < 4; ++i)
+            s[i] = splitmix64(seed);
+        for (int i = 0; i < stream; ++i)
+            long_jump();
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    /**
+     * Returns a number in [0, n), by scaling instead of a modulo.
+     */
+    int below(int n) {
+        return (int)(((next() >> 32) * (uint64_t)n) >> 32);
+    }
+
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    void long_jump() {
+        static const uint64_t JUMP[4] = {
+            0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+            0x77710069854ee241ULL, 0x39109bb02acbe635ULL
+        };
+        uint64_t t[4] = {0, 0, 0, 0};
+
+        for (int i = 0; i < 4; ++i) {
+            for (int b = 0; b < 64; ++b) {
+                if (JUMP[i] & (1ULL << b))
+                    for (int j = 0; j < 4; ++j)
+                        t[j] ^= s[j];
+                next();
+            }
+        }
+        for (int j = 0; j < 4; ++j)
+            s[j] = t[j];
+    }
+};
+
+/**
+ * Plays random games from a state. The game is played on a board owned by
+ * the playout and overwritten by every game, so a simulation allocates
+ * nothing; keep one per thread. Every move is drawn uniformly from the legal
+ * moves, leaving out the player's own single-point eyes unless fill_eyes is
+ * set, and the player passes when there is none. A game still running after
+ * max_moves moves is scored as it stands.
+ */
+template <int N>
+class Playout {
+public:
+    Playout(int max_moves = PLAYOUT_MAX_MOVES * N * N, bool fill_eyes = PLAYOUT_FILL_EYES)
+        : max_moves(max_moves), fill_eyes(fill_eyes) {
+    }
+
+    /**
+     * Plays one game to the end (or to the move cap).
+     * @param start The state where the game starts.
+     * @param rng The generator of the calling thread.
+     * @param steps Incremented by the number of moves played.
+     * @returns The winner (1, -1, or 0 for a draw).
+     */
+    int run(const Position<N> &start, Random &rng, unsigned long *steps) {
+        board = start;
+        played.clear();
+        first[0].clear();
+        first[1].clear();
+
+        int step = 0;
+        while (!board.game_over()) {
+            if (step == max_moves) {
+                *steps += step;
+                return board.area_winner();
+            }
+            step++;
+
+            Bitboard<N> moves = board.legal_moves(fill_eyes);
+            int count = moves.count();
+            if (count == 0) {
+                board.pass_move();
+            } else {
+                int p = moves.nth(rng.below(count));
+                if (!played.test(p)) {
+                    played.set(p);
+                    first[board.player == 1 ? 0 : 1].set(p);
+                }
+                board.play(p);
+            }
+        }
+
+        *steps += step;
+        return board.who_win();
+    }
+
+    /**
+     * The state where the last game stopped.
+     */
+    const Position<N> &last() const {
+        return board;
+    }
+
+    /**
+     * The points where a player put a stone first in the last game, for AMAF.
+     * @param color The color of the player, as in Position::stones.
+     */
+    const Bitboard<N> &first_moves(int color) const {
+        return first[color];
+    }
+
+private:
+    Position<N> board;
+    Bitboard<N> played;     // The points played in the last game
+    Bitboard<N> first[2];   // The ones of each color, see first_moves
+    int max_moves;
+    bool fill_eyes;
+};
+
+#endif
@@ -0,0 +1,996 @@
+#ifndef GOGAME_POSITION_H
+#define GOGAME_POSITION_H
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#define DEFAULT_BOARD_SIZE  9   // When not given on the command line
+
+/*
+ * Every board size (9, 13 or 19) is its own instantiation, so the loops over
+ * the words of a bitboard and the board mask are resolved at compile time.
+ *
+ * The board is a flat array framed by off-board sentinel points: a guard row
+ * above and below it, and a guard column after each row (which is also the
+ * one before the next row). (row, col) maps to (row + 1) * STRIDE + col, so
+ * the neighbors of a point are p +- 1 and p +- STRIDE, never out of the
+ * arrays, and a sentinel never holds a stone: there is nothing to check at
+ * the edges. Shifting a bitboard by 1 or by STRIDE moves every stone to one
+ * of its neighbors, and whatever goes over an edge lands on a sentinel,
+ * which is masked off.
+ */
+template <int N>
+struct Geometry {
+    static const int SIZE = N;
+    static const int STRIDE = N + 1;
+    static const int POINTS = (N + 2) * STRIDE;
+    static const int WORDS = (POINTS + 63) / 64;
+
+    static constexpr int point(int row, int col) {
+        return (row + 1) * STRIDE + col;
+    }
+
+    static constexpr bool inside(int p) {
+        return p >= STRIDE && p < (N + 1) * STRIDE && p % STRIDE != N;
+    }
+
+    static constexpr uint64_t board_word(int w, int b = 0) {
+        return b == 64 ? 0 : ((uint64_t)inside(w * 64 + b) << b) | board_word(w, b + 1);
+    }
+};
+
+template <int... I> struct IndexSeq {};
+template <int K, int... I> struct MakeSeq : MakeSeq<K - 1, K - 1, I...> {};
+template <int... I> struct MakeSeq<0, I...> { typedef IndexSeq<I...> type; };
+
+/**
+ * The tables of a board size, computed by the compiler: the words of the set
+ * of points on the board.
+ */
+template <int N, class W = typename MakeSeq<Geometry<N>::WORDS>::type>
+struct BoardTables;
+
+template <int N, int... W>
+struct BoardTables<N, IndexSeq<W...> > {
+    static constexpr uint64_t board[Geometry<N>::WORDS] = {Geometry<N>::board_word(W)...};
+};
+
+template <int N, int... W>
+constexpr uint64_t BoardTables<N, IndexSeq<W...> >::board[Geometry<N>::WORDS];
+
+/**
+ * A set of board points, one bit per point.
+ */
+template <int N>
+struct Bitboard {
+    static const int WORDS = Geometry<N>::WORDS;
+
+    uint64_t w[WORDS];
+
+    void clear() {
+        for (int i = 0; i < WORDS; ++i)
+            w[i] = 0;
+    }
+
+    bool test(int p) const {
+        return (w[p >> 6] >> (p & 63)) & 1;
+    }
+
+    void set(int p) {
+        w[p >> 6] |= (uint64_t)1 << (p & 63);
+    }
+
+    void reset(int p) {
+        w[p >> 6] &= ~((uint64_t)1 << (p & 63));
+    }
+
+    bool any() const {
+        uint64_t r = 0;
+        for (int i = 0; i < WORDS; ++i)
+            r |= w[i];
+        return r != 0;
+    }
+
+    int count() const {
+        int r = 0;
+        for (int i = 0; i < WORDS; ++i)
+            r += __builtin_popcountll(w[i]);
+        return r;
+    }
+
+    /**
+     * Returns the index of the lowest set bit. The set must not be empty.
+     */
+    int first() const {
+        int i = 0;
+        while (w[i] == 0)
+            ++i;
+        return (i << 6) + __builtin_ctzll(w[i]);
+    }
+
+    /**
+     * Returns the index of the k-th lowest set bit (k < count()).
+     */
+    int nth(int k) const {
+        int i = 0;
+        int c;
+        while ((c = __builtin_popcountll(w[i])) <= k) {
+            k -= c;
+            ++i;
+        }
+
+        uint64_t x = w[i];
+        while (k-- > 0)
+            x &= x - 1;
+        return (i << 6) + __builtin_ctzll(x);
+    }
+
+    Bitboard<N> operator|(const Bitboard &b) const {
+        Bitboard<N> r;
+        for (int i = 0; i < WORDS; ++i)
+            r.w[i] = w[i] | b.w[i];
+        return r;
+    }
+
+    Bitboard<N> operator&(const Bitboard &b) const {
+        Bitboard<N> r;
+        for (int i = 0; i < WORDS; ++i)
+            r.w[i] = w[i] & b.w[i];
+        return r;
+    }
+
+    /**
+     * Returns the points of this set that are not in b.
+     */
+    Bitboard<N> operator-(const Bitboard &b) const {
+        Bitboard<N> r;
+        for (int i = 0; i < WORDS; ++i)
+            r.w[i] = w[i] & ~b.w[i];
+        return r;
+    }
+
+    bool operator==(const Bitboard &b) const {
+        for (int i = 0; i < WORDS; ++i)
+            if (w[i] != b.w[i])
+                return false;
+        return true;
+    }
+
+    bool operator!=(const Bitboard &b) const {
+        return !(*this == b);
+    }
+
+    /**
+     * Moves every point k positions up in index (0 < k < 64).
+     */
+    Bitboard<N> shl(int k) const {
+        Bitboard<N> r;
+        for (int i = WORDS - 1; i > 0; --i)
+            r.w[i] = (w[i] << k) | (w[i - 1] >> (64 - k));
+        r.w[0] = w[0] << k;
+        return r;
+    }
+
+    /**
+     * Moves every point k positions down in index (0 < k < 64).
+     */
+    Bitboard<N> shr(int k) const {
+        Bitboard<N> r;
+        for (int i = 0; i < WORDS - 1; ++i)
+            r.w[i] = (w[i] >> k) | (w[i + 1] << (64 - k));
+        r.w[WORDS - 1] = w[WORDS - 1] >> k;
+        return r;
+    }
+};
+
+/**
+ * Returns the set of all the points on the board (guard bits cleared).
+ */
+template <int N>
+inline Bitboard<N> on_board() {
+    Bitboard<N> b;
+    for (int i = 0; i < Bitboard<N>::WORDS; ++i)
+        b.w[i] = BoardTables<N>::board[i];
+    return b;
+}
+
+/**
+ * Returns the points that are adjacent to at least one point of b.
+ */
+template <int N>
+inline Bitboard<N> neighbors(const Bitboard<N> &b) {
+    const int S = Geometry<N>::STRIDE;
+    return (b.shl(1) | b.shr(1) | b.shl(S) | b.shr(S)) & on_board<N>();
+}
+
+/**
+ * Returns the points at least k lines away from the edge of the board (the
+ * whole board for k = 0).
+ */
+template <int N>
+inline Bitboard<N> inner_points(int k) {
+    Bitboard<N> b;
+    b.clear();
+    for (int row = k; row < N - k; ++row)
+        for (int col = k; col < N - k; ++col)
+            b.set(Geometry<N>::point(row, col));
+    return b;
+}
+
+/**
+ * Steps the splitmix64 generator at x and returns its output. Used to turn a
+ * seed into well mixed keys and generator states.
+ */
+inline uint64_t splitmix64(uint64_t &x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Random keys for Zobrist hashing: one per (color, point) plus one for the
+ * player to move. The hash of a state is the xor of the keys of its stones,
+ * xor the player key when player -1 is to move.
+ */
+template <int N>
+struct Zobrist {
+    uint64_t stone[2][Geometry<N>::POINTS];
+    uint64_t player;
+
+    Zobrist() {
+        // splitmix64, with a fixed seed so that every process (and every MPI
+        // rank) computes the same hashes
+        uint64_t seed = 0x9e3779b97f4a7c15ULL;
+        for (int c = 0; c < 2; ++c)
+            for (int p = 0; p < Geometry<N>::POINTS; ++p)
+                stone[c][p] = splitmix64(seed);
+        player = splitmix64(seed);
+    }
+};
+
+template <int N>
+inline const Zobrist<N> &zobrist() {
+    static const Zobrist<N> keys;
+    return keys;
+}
+
+/**
+ * The stones of one chain (connected group) are kept in a circular list and
+ * every point of the chain refers to the chain head, where its statistics
+ * live. Liberties are counted as pseudo-liberties (one per stone-empty
+ * adjacency), together with their sum and sum of squares: the chain has no
+ * liberties when the count is zero, and a single liberty exactly when all
+ * the pseudo-liberties are the same point (count * sumsq == sum * sum).
+ */
+struct Chain {
+    int16_t size;
+    int16_t plibs;
+    int32_t lib_sum;
+    int32_t lib_sumsq;
+};
+
+/**
+ * What a move changed in a Position, so that unmake_move() can take it back:
+ * the state before the move, the chains joined by the stone and the chains
+ * it captured. A pass only needs the state.
+ */
+struct Undo {
+    int point;              // -1 for a pass
+    int ko_point, ko_turn;
+    int win_player;
+    bool player1_pass;
+    bool player2_pass;
+    uint64_t key;
+
+    int merge_num, capture_num;
+    uint16_t merged[4][2];  // (head kept, head joined) of each merge, in order
+    uint16_t captured[4];   // Heads of the chains taken off the board
+
+    // The chain data of the point before the stone, left there by a chain
+    // captured earlier, which its own undo record still needs
+    uint16_t old_id, old_next;
+    Chain old_chain;
+};
+
+/**
+ * This class represents a node in the tree. The board is kept as one bitboard
+ * per color plus one for the empty points, so a state is trivially copyable,
+ * and as a byte array for the point by point work around a move.
+ */
+template <int N>
+class Position {
+public:
+    static const int SIZE = Geometry<N>::SIZE;
+    static const int STRIDE = Geometry<N>::STRIDE;
+    static const int POINTS = Geometry<N>::POINTS;
+
+    static int point(int row, int col) {
+        return Geometry<N>::point(row, col);
+    }
+
+    static int row(int p) {
+        return p / STRIDE - 1;
+    }
+
+    static int col(int p) {
+        return p % STRIDE;
+    }
+
+    Bitboard<N> stones[2];  // [0] = player 1, [1] = player -1
+    Bitboard<N> empty;
+    int player;
+    int ko_point, ko_turn;
+
+    int win_player;
+    bool player1_pass;
+    bool player2_pass;
+
+    uint64_t key;           // Zobrist hash of the stones and the player to move
+
+    /* The same board, one byte per point: the color index of a stone (as in
+       stones[]), EMPTY, or OFF_BOARD for the sentinels */
+    enum { EMPTY = 2, OFF_BOARD = 3 };
+    uint8_t cells[POINTS];
+
+    uint16_t chain_id[POINTS];      // Head of the chain of each stone
+    uint16_t chain_next[POINTS];    // Next stone of the same chain
+    Chain chains[POINTS];           // Valid for chain heads only
+
+    /**
+     * Create a new state of the game.
+     */
+    Position() {
+        stones[0].clear();
+        stones[1].clear();
+        empty = on_board<N>();
+        for (int p = 0; p < POINTS; ++p)
+            cells[p] = empty.test(p) ? EMPTY : OFF_BOARD;
+        player = 1;
+        player1_pass = false;
+        player2_pass = false;
+        ko_point = -1;
+        ko_turn = 0;
+        win_player = 0;
+        key = 0;
+    }
+
+    /**
+     * Check if a move is valid.
+     * @param row The row where to check if it is a valid move.
+     * @param col The column where to check if it is a valid move.
+     */
+    bool is_valid(int row, int col) const {
+        if (row < 0 || row >= SIZE || col < 0 || col >= SIZE)
+            return false;
+
+        int p = point(row, col);
+        return p != ko_point && is_legal(p, color(player));
+    }
+
+    /**
+     * Returns the points where the current player can put a stone. Only the
+     * points with less than two empty neighbors need a closer look.
+     * @param fill_eyes When false, the player's own eyes are left out.
+     */
+    Bitboard<N> legal_moves(bool fill_eyes = true) const {
+        Bitboard<N> moves = open_points();
+        Bitboard<N> hard = empty - moves;
+        if (!fill_eyes)
+            hard = hard - eyes(player);
+        int me = color(player);
+
+        while (hard.any()) {
+            int p = hard.first();
+            hard.reset(p);
+            if (is_legal(p, me))
+                moves.set(p);
+        }
+
+        if (ko_point != -1)
+            moves.reset(ko_point);
+        return moves;
+    }
+
+    /**
+     * Make a move.
+     * @param row The row where to put the stone.
+     * @param col The column where to put the stone.
+     * @param undo When given, records the move for unmake_move().
+     */
+    int make_move(int row, int col, Undo *undo = NULL) {
+        if (undo)
+            save(*undo);
+
+        // pass for human player
+        if (row == -2 && col == -2) {
+            player = -player;
+            key ^= zobrist<N>().player;
+            ko_point = -1;
+            return -2;
+        }
+
+        if (!is_valid(row, col))
+            return -1;
+
+        return place(point(row, col), undo);
+    }
+
+    /**
+     * Make a move known to be legal, such as one taken from legal_moves().
+     * @param p The point where to put the stone.
+     * @param undo When given, records the move for unmake_move().
+     */
+    int play(int p, Undo *undo = NULL) {
+        if (undo)
+            save(*undo);
+        return place(p, undo);
+    }
+
+    /**
+     * Check if current player passes the game.
+     */
+    bool is_pass() const {
+        if (ko_turn > 9) {
+            return true;
+        }
+
+        // Most of the time there is a point with two empty neighbors
+        Bitboard<N> moves = open_points();
+        if (ko_point != -1)
+            moves.reset(ko_point);
+        if (moves.any())
+            return false;
+
+        Bitboard<N> hard = empty - moves;
+        int me = color(player);
+        while (hard.any()) {
+            int p = hard.first();
+            hard.reset(p);
+            if (p != ko_point && is_legal(p, me))
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * Change the current state, when the player cannot make a move.
+     * @param undo When given, records the move for unmake_move().
+     */
+    void pass_move(Undo *undo = NULL) {
+        if (undo)
+            save(*undo);
+
+        if (ko_turn > 9) {
+            win_player = 0;
+        }
+        if (ko_point == -1) {
+            if (player == 1)
+                player1_pass = true;
+            else
+                player2_pass = true;
+        } else {
+            ko_point = -1;
+        }
+
+        player = -player;
+        key ^= zobrist<N>().player;
+    }
+
+    /**
+     * Take back the last move made (or passed) with an undo record. Moves
+     * must be taken back in the reverse order.
+     * @param undo The record filled by make_move() or pass_move().
+     */
+    void unmake_move(const Undo &undo) {
+        int p = undo.point;
+        if (p != -1) {
+            int me = cells[p];
+
+            // Put the captured chains back, then split the joined chains
+            for (int k = undo.capture_num - 1; k >= 0; --k)
+                restore_chain(undo.captured[k], 1 - me);
+            for (int k = undo.merge_num - 1; k >= 0; --k)
+                split_chains(undo.merged[k][0], undo.merged[k][1]);
+
+            stones[me].reset(p);
+            empty.set(p);
+            cells[p] = EMPTY;
+            chain_id[p] = undo.old_id;
+            chain_next[p] = undo.old_next;
+            chains[p] = undo.old_chain;
+
+            const int adj[4] = {p + STRIDE, p - STRIDE, p + 1, p - 1};
+            for (int i = 0; i < 4; ++i) {
+                int n = adj[i];
+                if (cells[n] < EMPTY)
+                    add_liberty(chain_id[n], p);
+            }
+        }
+
+        player = -player;
+        ko_point = undo.ko_point;
+        ko_turn = undo.ko_turn;
+        win_player = undo.win_player;
+        player1_pass = undo.player1_pass;
+        player2_pass = undo.player2_pass;
+        key = undo.key;
+    }
+
+    /**
+     * Check if the game is over.
+     */
+    bool game_over() {
+        if (ko_turn > 9) {
+            return true;
+        }
+        if (player1_pass && player2_pass)
+            win_player = area_winner();
+        return player1_pass && player2_pass;
+    }
+
+    /**
+     * Scores the board as it stands: every player gets its stones and the
+     * empty points that touch only its stones, the other empty points next
+     * to stones are split, and player -1 gets 7.5 points of komi.
+     * @returns The winning player.
+     */
+    int area_winner() const {
+        // An empty point counts for a player when it touches only that
+        // player's stones and is shared when it touches two kinds of points
+        Bitboard<N> near1 = neighbors<N>(stones[0]);
+        Bitboard<N> near2 = neighbors<N>(stones[1]);
+        Bitboard<N> near0 = neighbors<N>(empty);
+        Bitboard<N> shared = (near1 & near2) | (near1 & near0) | (near2 & near0);
+        Bitboard<N> only1 = near1 - near2 - near0;
+        Bitboard<N> only2 = near2 - near1 - near0;
+
+        double half = 0.5 * (shared & empty).count();
+        double player1_res = stones[0].count() + (only1 & empty).count() + half;
+        double player2_res = stones[1].count() + (only2 & empty).count() + half;
+
+        if (player1_res > player2_res + 7.5)
+            return 1;
+        return -1;
+    }
+
+    /**
+     * Returns the single-point true eyes of a player (1, -1): the empty
+     * points whose neighbors are all stones of the player, with at most one
+     * opponent stone on the diagonals (none at the edge). Filling one only
+     * takes a liberty away from the player's own chains.
+     */
+    Bitboard<N> eyes(int player_) const {
+        int c = color(player_);
+        Bitboard<N> cand = empty - neighbors<N>(empty | stones[1 - c]);
+        Bitboard<N> r;
+        r.clear();
+
+        while (cand.any()) {
+            int p = cand.first();
+            cand.reset(p);
+
+            // p - STRIDE - 1 is before the array for the first point only
+            const int diag[4] = {p + STRIDE + 1, p + STRIDE - 1, p - STRIDE + 1, p - STRIDE - 1};
+            int opp = 0, edge = 0;
+            for (int i = 0; i < 4; ++i) {
+                int d = diag[i] >= 0 ? cells[diag[i]] : (int)OFF_BOARD;
+                if (d == OFF_BOARD)
+                    edge = 1;
+                else if (d == 1 - c)
+                    opp++;
+            }
+            if (opp + edge < 2)
+                r.set(p);
+        }
+        return r;
+    }
+
+    /**
+     * Returns the winning player.
+     */
+    int who_win() const {
+        return win_player;
+    }
+
+    /**
+     * Returns the player (1, -1) owning (row, col), or 0 for an empty point.
+     */
+    int at(int row, int col) const {
+        int c = cells[point(row, col)];
+        if (c == 0)
+            return 1;
+        if (c == 1)
+            return -1;
+        return 0;
+    }
+
+    /**
+     * Print the board in current state.
+     */
+    void print() const {
+        // The columns are labeled by their last digit
+        std::cout << " ";
+        for (int j = 0; j < SIZE; ++j)
+            std::cout << " " << j % 10;
+        std::cout << std::endl;
+
+        for (int i = 0; i < SIZE; ++i) {
+            std::cout << (i < 10 ? " " : "") << i;
+            for (int j = 0; j < SIZE; ++j) {
+                if (at(i, j) == 1)
+                    std::cout << "#"
+                              << " ";
+                if (at(i, j) == 0)
+                    std::cout << "."
+                              << " ";
+                if (at(i, j) == -1)
+                    std::cout << "@"
+                              << " ";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    /**
+     * Convert current state to a string.
+     */
+    const std::string to_string() const {
+        std::string res;
+        for (int i = 0; i < SIZE; ++i) {
+            for (int j = 0; j < SIZE; ++j) {
+                if (at(i, j) == 1)
+                    res.push_back('*');
+                if (at(i, j) == 0)
+                    res.push_back('.');
+                if (at(i, j) == -1)
+                    res.push_back('@');
+            }
+        }
+        if (player == 1)
+            res.push_back('#');
+        else
+            res.push_back('&');
+        return res;
+    }
+
+    /**
+     * Compare two different states.
+     * @param p The state to be compared with.
+     */
+    bool operator==(const Position &p) const {
+        // The boards are only compared when the hashes are the same
+        return key == p.key && player == p.player && stones[0] == p.stones[0] && stones[1] == p.stones[1];
+    }
+
+private:
+    /**
+     * Maps a player (1, -1) to the index of its bitboard.
+     */
+    static int color(int player_) {
+        return player_ == 1 ? 0 : 1;
+    }
+
+    void add_liberty(int head, int lib) {
+        Chain &c = chains[head];
+        c.plibs++;
+        c.lib_sum += lib;
+        c.lib_sumsq += lib * lib;
+    }
+
+    void remove_liberty(int head, int lib) {
+        Chain &c = chains[head];
+        c.plibs--;
+        c.lib_sum -= lib;
+        c.lib_sumsq -= lib * lib;
+    }
+
+    /**
+     * Check if a chain has exactly one liberty.
+     */
+    bool in_atari(int head) const {
+        const Chain &c = chains[head];
+        return c.plibs > 0 && (int64_t)c.plibs * c.lib_sumsq == (int64_t)c.lib_sum * c.lib_sum;
+    }
+
+    /**
+     * Put a stone of the player to move at p and play out the captures.
+     */
+    int place(int p, Undo *undo) {
+        int me = color(player);
+
+        int opp = 1 - me;
+        const int adj[4] = {p + STRIDE, p - STRIDE, p + 1, p - 1};
+
+        if (undo) {
+            undo->point = p;
+            undo->old_id = chain_id[p];
+            undo->old_next = chain_next[p];
+            undo->old_chain = chains[p];
+        }
+
+        // Put the stone as a new chain, then join the neighboring chains
+        stones[me].set(p);
+        empty.reset(p);
+        cells[p] = me;
+        key ^= zobrist<N>().stone[me][p];
+        chain_id[p] = p;
+        chain_next[p] = p;
+        chains[p].size = 1;
+        chains[p].plibs = 0;
+        chains[p].lib_sum = 0;
+        chains[p].lib_sumsq = 0;
+
+        for (int i = 0; i < 4; ++i) {
+            int n = adj[i];
+            if (cells[n] == EMPTY)
+                add_liberty(p, n);
+            else if (cells[n] < EMPTY)
+                remove_liberty(chain_id[n], p);
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            int n = adj[i];
+            if (cells[n] == me && chain_id[n] != chain_id[p])
+                merge_chains(chain_id[p], chain_id[n], undo);
+        }
+
+        // Remove the opponent chains left without liberties
+        ko_point = -1;
+        for (int i = 0; i < 4; ++i) {
+            int n = adj[i];
+            if (cells[n] != opp || chains[chain_id[n]].plibs != 0)
+                continue;
+
+            if (undo)
+                undo->captured[undo->capture_num++] = chain_id[n];
+            if (remove_chain(chain_id[n], opp) == 1) {
+                ko_point = n;
+                ko_turn++;
+            }
+        }
+
+        if (ko_point == -1)
+            ko_turn = 0;
+
+        if (player == 1)
+            player1_pass = false;
+        else
+            player2_pass = false;
+
+        player = -player;
+        key ^= zobrist<N>().player;
+        return 0;
+    }
+
+    /**
+     * Saves the state that a move changes besides the board.
+     */
+    void save(Undo &undo) const {
+        undo.point = -1;
+        undo.ko_point = ko_point;
+        undo.ko_turn = ko_turn;
+        undo.win_player = win_player;
+        undo.player1_pass = player1_pass;
+        undo.player2_pass = player2_pass;
+        undo.key = key;
+        undo.merge_num = 0;
+        undo.capture_num = 0;
+    }
+
+    /**
+     * Joins two chains, relabeling the stones of the smaller one.
+     */
+    void merge_chains(int a, int b, Undo *undo) {
+        if (chains[a].size < chains[b].size) {
+            int tmp = a;
+            a = b;
+            b = tmp;
+        }
+
+        if (undo) {
+            undo->merged[undo->merge_num][0] = a;
+            undo->merged[undo->merge_num][1] = b;
+            undo->merge_num++;
+        }
+
+        int s = b;
+        do {
+            chain_id[s] = a;
+            s = chain_next[s];
+        } while (s != b);
+
+        int tmp = chain_next[a];
+        chain_next[a] = chain_next[b];
+        chain_next[b] = tmp;
+
+        chains[a].size += chains[b].size;
+        chains[a].plibs += chains[b].plibs;
+        chains[a].lib_sum += chains[b].lib_sum;
+        chains[a].lib_sumsq += chains[b].lib_sumsq;
+    }
+
+    /**
+     * Undoes merge_chains(a, b). The statistics of b were left as they were
+     * when it was joined, so they are taken back from a.
+     */
+    void split_chains(int a, int b) {
+        int tmp = chain_next[a];
+        chain_next[a] = chain_next[b];
+        chain_next[b] = tmp;
+
+        int s = b;
+        do {
+            chain_id[s] = b;
+            s = chain_next[s];
+        } while (s != b);
+
+        chains[a].size -= chains[b].size;
+        chains[a].plibs -= chains[b].plibs;
+        chains[a].lib_sum -= chains[b].lib_sum;
+        chains[a].lib_sumsq -= chains[b].lib_sumsq;
+    }
+
+    /**
+     * Takes a chain off the board, giving its points back as liberties to the
+     * chains around it.
+     * @param head The head of the chain to be removed.
+     * @param c The index of the color of the chain.
+     * @returns The number of stones removed.
+     */
+    int remove_chain(int head, int c) {
+        const Zobrist<N> &keys = zobrist<N>();
+        int s = head;
+        do {
+            stones[c].reset(s);
+            empty.set(s);
+            cells[s] = EMPTY;
+            key ^= keys.stone[c][s];
+
+            const int adj[4] = {s + STRIDE, s - STRIDE, s + 1, s - 1};
+            for (int i = 0; i < 4; ++i) {
+                int n = adj[i];
+                if (cells[n] == 1 - c)
+                    add_liberty(chain_id[n], s);
+            }
+            s = chain_next[s];
+        } while (s != head);
+
+        return chains[head].size;
+    }
+
+    /**
+     * Undoes remove_chain(head, c): the list and the statistics of a removed
+     * chain are left in place, only the board and the liberties around it
+     * change.
+     */
+    void restore_chain(int head, int c) {
+        int s = head;
+        do {
+            stones[c].set(s);
+            empty.reset(s);
+            cells[s] = c;
+
+            const int adj[4] = {s + STRIDE, s - STRIDE, s + 1, s - 1};
+            for (int i = 0; i < 4; ++i) {
+                int n = adj[i];
+                if (cells[n] == 1 - c)
+                    remove_liberty(chain_id[n], s);
+            }
+            s = chain_next[s];
+        } while (s != head);
+    }
+
+    /**
+     * Returns the empty points with at least two empty neighbors. A stone put
+     * there keeps two liberties whatever happens around it, so the move is
+     * legal for both players (the ko aside).
+     */
+    Bitboard<N> open_points() const {
+        Bitboard<N> a = empty.shl(1);
+        Bitboard<N> b = empty.shr(1);
+        Bitboard<N> c = empty.shl(STRIDE);
+        Bitboard<N> d = empty.shr(STRIDE);
+        return ((a & b) | (c & d) | ((a | b) & (c | d))) & empty;
+    }
+
+    /**
+     * Check if a stone of color c can be put on p, the ko aside: the point is
+     * empty and after the captures the new chain is neither without
+     * liberties nor a large chain (more than 5 stones) in atari. Only the
+     * chains around p are inspected, so the check is O(chain size).
+     */
+    bool is_legal(int p, int c) const {
+        if (cells[p] != EMPTY)
+            return false;
+
+        const int adj[4] = {p + STRIDE, p - STRIDE, p + 1, p - 1};
+        int libs[2];
+        int lib_num = 0;
+        int own[4], captured[4];
+        int own_num = 0, captured_num = 0;
+        int size = 1;
+
+        for (int i = 0; i < 4; ++i) {
+            int n = adj[i];
+            if (cells[n] == EMPTY) {
+                if (add_distinct(libs, lib_num, n))
+                    return true;
+            } else if (cells[n] == c) {
+                int h = chain_id[n];
+                if (!contains(own, own_num, h)) {
+                    own[own_num++] = h;
+                    size += chains[h].size;
+                }
+            } else if (cells[n] == 1 - c && in_atari(chain_id[n])) {
+                // The only liberty is p, so the whole chain is captured
+                if (!contains(captured, captured_num, chain_id[n]))
+                    captured[captured_num++] = chain_id[n];
+                if (add_distinct(libs, lib_num, n))
+                    return true;
+            }
+        }
+
+        if (lib_num == 1 && size <= 5)
+            return true;
+
+        // Look for the other liberties of the chains that p joins
+        for (int k = 0; k < own_num; ++k) {
+            // A chain in atari has no liberty other than p, unless it touches
+            // the stones being captured
+            if (captured_num == 0 && in_atari(own[k]))
+                continue;
+
+            int s = own[k];
+            do {
+                const int sadj[4] = {s + STRIDE, s - STRIDE, s + 1, s - 1};
+                for (int i = 0; i < 4; ++i) {
+                    int n = sadj[i];
+                    if (n == p)
+                        continue;
+
+                    bool lib = cells[n] == EMPTY ||
+                               (cells[n] == 1 - c && contains(captured, captured_num, chain_id[n]));
+                    if (lib && add_distinct(libs, lib_num, n))
+                        return true;
+                }
+                s = chain_next[s];
+            } while (s != own[k]);
+        }
+
+        return lib_num == 1 && size <= 5;
+    }
+
+    static bool contains(const int *a, int n, int x) {
+        for (int i = 0; i < n; ++i)
+            if (a[i] == x)
+                return true;
+        return false;
+    }
+
+    /**
+     * Adds x to a set of at most two points.
+     * @returns True when the set holds two different points.
+     */
+    static bool add_distinct(int *a, int &n, int x) {
+        if (n == 0 || a[0] != x)
+            a[n++] = x;
+        return n >= 2;
+    }
+};
+
+static_assert(std::is_trivially_copyable<Position<9> >::value, "Position must be trivially copyable");
+
+namespace std {
+    /* Hash a state by its Zobrist key */
+    template <int N> struct hash<Position<N> > {
+        size_t operator()(const Position<N> &obj) const {
+            return obj.key;
+        }
+    };
+}
+
+#endif
@@ -6,21 +6,27 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/types.h>
-#include <unordered_map>
 #include <vector>
 
+#include "GoGame_mcts.h"
+#include "GoGame_playout.h"
+
 using namespace std;
 
 #define VISUAL              0   // For visualizing the game
 #define LOG                 1   // For printing the average time
-
-#define RANDOM_PLAY         0   // 1 = Random simulation
+#define LOG_TREE            1   // For printing the memory of the trees at every move
 
 #define USE_TIME_ROUND      1   // 1 = Use time; 0 = Use iterations
 #define TIME_PER_ROUND      0.5   // In seconds
+#define TIME_MANAGER        0   // 1 = time_round is the main time of each player for the game (TimeManager)
+#define BYO_YOMI            0.0 // ... then the time of every move (0 = sudden death)
 
 #define USE_TIME_SIM        1   // 1 = Use time; 0 = Use iterations
 #define TIME_PER_SIM        0.05 // In seconds
+#define EARLY_STOP          0   // 1 = A search stops once the games left cannot change its move
+
+#define ONE_TREE            0   // 1 = Both players search one tree, scored for player 1
 
 
 /**
@@ -40,548 +46,64 @@ void timing(double *wcTime, double *cpuTime) {
 }
 
 /**
- * This class represents a node in the tree.
- */
-class Position {
-public:
-    vector<vector<int>> board;
-    vector<vector<bool>> is_visit;
-    int player;
-    int ko_row, ko_col, ko_turn;
-
-    int win_player;
-    bool player1_pass;
-    bool player2_pass;
-
-    /**
-     * Create a new state of the game.
-     */
-    Position() {
-        player = 1;
-        player1_pass = false;
-        player2_pass = false;
-        ko_row = -1;
-        ko_col = -1;
-        ko_turn = 0;
-        win_player = 0;
-
-        for (int i = 0; i < 9; ++i) {
-            vector<int> tmp;
-            for (int i = 0; i < 9; ++i)
-                tmp.push_back(0);
-            board.push_back(tmp);
-        }
-
-        for (int i = 0; i < 9; ++i) {
-            vector<bool> tmp;
-            for (int i = 0; i < 9; ++i)
-                tmp.push_back(false);
-            is_visit.push_back(tmp);
-        }
-    }
-
-    /**
-     * Create a new copy of the state given as parameter.
-     * @param t The state to be copied.
-     */
-    Position(const Position &t) {
-        board = t.board;
-        player1_pass = t.player1_pass;
-        player2_pass = t.player2_pass;
-        ko_row = t.ko_row;
-        ko_col = t.ko_col;
-        ko_turn = t.ko_turn;
-        win_player = t.win_player;
-        player = t.player;
-
-        for (int i = 0; i < 9; ++i) {
-            vector<bool> tmp;
-            for (int i = 0; i < 9; ++i)
-                tmp.push_back(false);
-            is_visit.push_back(tmp);
-        }
-    }
-
-    /**
-     * Create a new state, given the board and the player.
-     * @param board_ Current board state.
-     * @param p Current player.
-     */
-    Position(vector<vector<int>> board_, int p) {
-        player = p;
-        board = board_;
-
-        for (int i = 0; i < 9; ++i) {
-            vector<bool> tmp;
-            for (int i = 0; i < 9; ++i)
-                tmp.push_back(false);
-            is_visit.push_back(tmp);
-        }
-    }
-
-    /**
-     * Check if a move is valid.
-     * @param row The row where to check if it is a valid move.
-     * @param col The column where to check if it is a valid move.
-     */
-    bool is_valid(int row, int col) {
-        if (board[row][col] != 0 || (row == ko_row && col == ko_col))
-            return false;
-        else {
-            Position tmp(board, player);
-            board[row][col] = player;
-            if (count_eyes(row + 1, col, -player) == 0) {
-                remove_stone(-player);
-            }
-            if (count_eyes(row - 1, col, -player) == 0) {
-                remove_stone(-player);
-            }
-            if (count_eyes(row, col + 1, -player) == 0) {
-                remove_stone(-player);
-            }
-            if (count_eyes(row, col - 1, -player) == 0) {
-                remove_stone(-player);
-            }
-
-            int stone_num = 0;
-            int t = count_eyes_zero(row, col, player, stone_num);
-
-            if (t == 0 || (t == 1 && stone_num > 5)) {
-                board = tmp.board;
-                return false;
-            }
-
-            board = tmp.board;
-            player = tmp.player;
-            return true;
-        }
-    }
-
-    /**
-     * Make a move.
-     * @param row The row where to put the stone.
-     * @param col The column where to put the stone.
-     */
-    int make_move(int row, int col) {
-        // pass for human player
-        if (row == -2 && col == -2) {
-            player = -player;
-            ko_row = -1;
-            ko_col = -1;
-            return -2;
-        }
-
-        if (board[row][col] != 0 || (row == ko_row && col == ko_col)) {
-            return -1;
-        } else {
-            vector<vector<int>> tmp_board = board;
-            int ko_turn_ = ko_turn;
-            int ko_row_ = ko_row;
-            int ko_col_ = ko_col;
-
-            board[row][col] = player;
-            ko_row = -1;
-            ko_col = -1;
-
-            if (count_eyes(row + 1, col, -player) == 0) {
-                if (remove_stone(-player) == 1) {
-                    ko_row = row + 1;
-                    ko_col = col;
-                    ko_turn++;
-                }
-            }
-            if (count_eyes(row - 1, col, -player) == 0) {
-                if (remove_stone(-player) == 1) {
-                    ko_row = row - 1;
-                    ko_col = col;
-                    ko_turn++;
-                }
-            }
-            if (count_eyes(row, col + 1, -player) == 0) {
-                if (remove_stone(-player) == 1) {
-                    ko_row = row;
-                    ko_col = col + 1;
-                    ko_turn++;
-                }
-            }
-            if (count_eyes(row, col - 1, -player) == 0) {
-                if (remove_stone(-player) == 1) {
-                    ko_row = row;
-                    ko_col = col - 1;
-                    ko_turn++;
-                }
-            }
-
-            int stone_num = 0;
-            int t = count_eyes_zero(row, col, player, stone_num);
-
-            if (t == 0 || (t == 1 && stone_num > 5)) {
-                board = tmp_board;
-                ko_row = ko_row_;
-                ko_col = ko_col_;
-                ko_turn_ = ko_turn;
-                return -1;
-            }
-
-            if (ko_row == -1)
-                ko_turn = 0;
-        }
-
-        if (player == 1)
-            player1_pass = false;
-        else
-            player2_pass = false;
-
-        player = -player;
-        return 0;
-    }
-
-    /**
-     * Check if current player passes the game.
-     */
-    bool is_pass() {
-        if (ko_turn > 9) {
-            return true;
-        }
-
-        for (int i = 0; i < 9; ++i)
-            for (int j = 0; j < 9; ++j) {
-                if (is_valid(i, j)) {
-                    return false;
-                }
-            }
-        return true;
-    }
-
-    /**
-     * Change the current state, when the player cannot make a move.
-     */
-    void pass_move() {
-        if (ko_turn > 9) {
-            win_player = 0;
-        }
-        if (ko_row == -1 && ko_col == -1) {
-            if (player == 1)
-                player1_pass = true;
-            else
-                player2_pass = true;
-        } else {
-            ko_row = -1;
-            ko_col = -1;
-        }
-
-        player = -player;
-    }
-
-    /**
-     * Check if the game is over.
-     */
-    bool game_over() {
-        if (ko_turn > 9) {
-            return true;
-        }
-        if (player1_pass && player2_pass) {
-            double player1_res = 0.0, player2_res = 0.0;
-            for (int i = 0; i < 9; ++i) {
-                for (int j = 0; j < 9; ++j) {
-                    if (board[i][j] == 1)
-                        player1_res++;
-                    if (board[i][j] == -1)
-                        player2_res++;
-                    if (board[i][j] == 0) {
-                        bool player1_stone = false, player2_stone = false, blank = false;
-
-                        if (i - 1 >= 0) {
-                            if (board[i - 1][j] == 1)
-                                player1_stone = true;
-                            if (board[i - 1][j] == -1)
-                                player2_stone = true;
-                            if (board[i - 1][j] == 0)
-                                blank = true;
-                        }
-                        if (i + 1 <= 8) {
-                            if (board[i + 1][j] == 1)
-                                player1_stone = true;
-                            if (board[i + 1][j] == -1)
-                                player2_stone = true;
-                            if (board[i + 1][j] == 0)
-                                blank = true;
-                        }
-                        if (j - 1 >= 0) {
-                            if (board[i][j - 1] == 1)
-                                player1_stone = true;
-                            if (board[i][j - 1] == -1)
-                                player2_stone = true;
-                            if (board[i][j - 1] == 0)
-                                blank = true;
-                        }
-                        if (j + 1 <= 8) {
-                            if (board[i][j + 1] == 1)
-                                player1_stone = true;
-                            if (board[i][j + 1] == -1)
-                                player2_stone = true;
-                            if (board[i][j + 1] == 0)
-                                blank = true;
-                        }
-                        int true_value = 0;
-                        if (player1_stone == true)
-                            true_value++;
-                        if (player2_stone == true)
-                            true_value++;
-                        if (blank == true)
-                            true_value++;
-                        if (true_value >= 2) {
-                            player1_res += 0.5;
-                            player2_res += 0.5;
-                        } else {
-                            if (player1_stone == true)
-                                player1_res += 1;
-                            if (player2_stone == true)
-                                player2_res += 1;
-                        }
-                    }
-                }
-            }
-            if (player1_res > player2_res + 7.5)
-                win_player = 1;
-            else
-                win_player = -1;
-        }
-        return player1_pass && player2_pass;
-    }
-
-    /**
-     * Returns the winning player.
-     */
-    int who_win() {
-        return win_player;
-    }
-
-    /**
-     * Print the board in current state.
-     */
-    void print() {
-        cout << "  0 1 2 3 4 5 6 7 8" << endl;
-        for (int i = 0; i < 9; ++i) {
-            cout << " " << i;
-            for (int j = 0; j < 9; ++j) {
-                if (board[i][j] == 1)
-                    cout << "#"
-                         << " ";
-                if (board[i][j] == 0)
-                    cout << "."
-                         << " ";
-                if (board[i][j] == -1)
-                    cout << "@"
-                         << " ";
-            }
-            cout << endl;
-        }
-    }
-
-    /**
-     * Convert current state to a string.
-     */
-    const string to_string() const {
-        string res;
-        for (int i = 0; i < 9; ++i) {
-            for (int j = 0; j < 9; ++j) {
-                if (board[i][j] == 1)
-                    res.push_back('*');
-                if (board[i][j] == 0)
-                    res.push_back('.');
-                if (board[i][j] == -1)
-                    res.push_back('@');
-            }
-        }
-        if (player == 1)
-            res.push_back('#');
-        else
-            res.push_back('&');
-        return res;
-    }
-
-    /**
-     * Compare two different states.
-     * @param p The state to be compared with.
-     */
-    bool operator==(const Position &p) const {
-        return (board == p.board) && (player == p.player);
-    }
-
-private:
-    /**
-     * Count the eyes using DFS, for a given player. A single empty space inside
-     * a group is called an eye.
-     * @param row The row where to check for eye.
-     * @param col The column where to check for eye.
-     * @param player_ The player for which to search of eye.
-     */
-    int count_eyes(int row, int col, int player_) {
-        // Invalid parameters, return -1
-        if (row < 0 || row > 8 || col < 0 || col > 8 || board[row][col] != player_)
-            return -1;
-
-        // Reset the state of is_visit
-        for (int i = 0; i < 9; ++i) {
-            for (int j = 0; j < 9; ++j) {
-                is_visit[i][j] = false;
-            }
-        }
-
-        // Apply DFS to count the eyes
-        int res = 0;
-        dfs(row, col, board[row][col], res);
-        return res;
-    }
-
-    /**
-     * Count the eyes.
-     */
-    void dfs(int row, int col, int player_, int &res) {
-        // Invalid state or visited state or other player's stone at (row, col), finish the search
-        if (row < 0 || row > 8 || col < 0 || col > 8 || is_visit[row][col] == true || board[row][col] == -player_)
-            return;
-
-        // Mark (row, col) as visited
-        is_visit[row][col] = true;
-
-        // If the (row, col) is of player_, continue searching on neighbors 
-        if (board[row][col] == player_) {
-            dfs(row + 1, col, player_, res);
-            dfs(row - 1, col, player_, res);
-            dfs(row, col + 1, player_, res);
-            dfs(row, col - 1, player_, res);
-        }
-
-        // If (row, col) is 0 (empty cell), increment the result
-        if (board[row][col] == 0) {
-            res += 1;
-        }
-    }
-
-    int count_eyes_zero(int row, int col, int player_, int &stone_num) {
-        if (row < 0 || row > 8 || col < 0 || col > 8 || board[row][col] != player_)
-            return 10;
-
-        for (int i = 0; i < 9; ++i) {
-            for (int j = 0; j < 9; ++j) {
-                is_visit[i][j] = false;
-            }
-        }
-
-        int res = 0;
-        stone_num = dfs_fast_end(row, col, board[row][col], res);
-
-        return res;
-    }
-
-    int dfs_fast_end(int row, int col, int player_, int &res) {
-        if (res > 1 || row < 0 || row > 8 || col < 0 || col > 8 || is_visit[row][col] == true || board[row][col] == -player_)
-            return 0;
-
-        is_visit[row][col] = true;
-        if (board[row][col] == player_) {
-            return dfs_fast_end(row + 1, col, player_, res) +
-                   dfs_fast_end(row - 1, col, player_, res) +
-                   dfs_fast_end(row, col + 1, player_, res) +
-                   dfs_fast_end(row, col - 1, player_, res) + 1;
-        }
-
-        if (board[row][col] == 0) {
-            res += 1;
-        }
-
-        return 0;
-    }
-
-    /**
-     * Removes stones form the board, for a given player.
-     */
-    int remove_stone(int player_) {
-        int res = 0;
-        for (int i = 0; i < 9; ++i) {
-            for (int j = 0; j < 9; ++j) {
-                if (is_visit[i][j] == true && board[i][j] == player_) {
-                    board[i][j] = 0;
-                    res++;
-                }
-            }
-        }
-        return res;
-    }
-};
-
-/**
- * This class is a linked list of values for total games and total wins.
- */
-class value {
-public:
-    value *last_pos_value;
-    double total_game;
-    double total_win;
-
-    value(value *p_v, double g, double w) {
-        last_pos_value = p_v;
-        total_win = w;
-        total_game = g;
-    }
-
-    void print() {
-#if VISUAL
-        cout << total_game << " " << total_win << endl;
-#endif
-    }
-};
-
-/**
- * Creates a list of possible moves from current state. This list can be also
- * seen as the possible childs of current state.
+ * Lists the moves from current state: the pass when the player cannot put a
+ * stone, else every legal point, the ones far from the edge first.
  * @param s Current state.
- * @param next_pos An array of next states, returned by side effect.
+ * @param moves The points where to put a stone (-1 for the pass), returned by
+ * side effect.
+ * @returns The number of moves.
  */
-void get_next_pos(Position *s, vector<Position> &next_pos) {
-    next_pos.clear();
-
-    // If pass move, then the next pos is only the "pass move"
+template <int N>
+int get_next_moves(Position<N> *s, int *moves) {
+    // If pass move, then the next move is only the "pass move"
     if (s->is_pass()) {
-        Position tmp(*s);
-        tmp.pass_move();
-        next_pos.push_back(tmp);
-        return;
+        moves[0] = -1;
+        return 1;
     }
 
-    // Check for each cell if the move can be done.
-    for (int i = 0; i < 9; ++i) {
-        for (int j = 0; j < 9; ++j) {
-            Position tmp(*s);
-
-            if (tmp.make_move(i, j) != -1)
-                next_pos.push_back(tmp);
+    // The points from the 4th line inwards first, then the 3rd, 2nd and 1st
+    // lines: a cheap prior, as the selection opens the first moves of a node
+    // first until they have AMAF scores (see Tree::prior)
+    static const Bitboard<N> rings[3] = {inner_points<N>(3), inner_points<N>(2), inner_points<N>(1)};
+
+    int move_num = 0;
+    Bitboard<N> legal = s->legal_moves();
+    for (int i = 0; i <= 3; ++i) {
+        Bitboard<N> ring = i < 3 ? legal & rings[i] : legal;
+        legal = legal - ring;
+        while (ring.any()) {
+            int p = ring.first();
+            ring.reset(p);
+            moves[move_num++] = p;
         }
     }
+    return move_num;
 }
 
-namespace std {
-    /* Overwrite the hash operation */
-	template <> struct hash<Position> {
-		size_t operator()(const Position obj) const {
-			return hash<string>()(obj.to_string());
-		}
-	};
+/**
+ * Plays a move given by get_next_moves.
+ * @param s The current state.
+ * @param move The point where to put the stone, -1 for the pass.
+ * @param undo When given, records the move to take it back.
+ */
+template <int N>
+void play_move(Position<N> *s, int move, Undo *undo) {
+    if (move == -1)
+        s->pass_move(undo);
+    else
+        s->play(move, undo);
 }
 
 /**
  * This is a random player.
  * @param s The current state.
  */
-void random_play(Position *s) {
+template <int N>
+void random_play(Position<N> *s) {
     if (!s->is_pass()) {
-        int x, y;
-        do {
-            x = rand() % 9;
-            y = rand() % 9;
-        } while (s->make_move(x, y) == -1);
+        Bitboard<N> moves = s->legal_moves();
+        int p = moves.nth(rand() % moves.count());
+        s->make_move(Position<N>::row(p), Position<N>::col(p));
     } else {
         s->pass_move();
     }
@@ -591,7 +113,8 @@ void random_play(Position *s) {
  * This is for manual play (playing against a human).
  * @param s The current state.
  */
-void manual_play(Position *s) {
+template <int N>
+void manual_play(Position<N> *s) {
     if (!s->is_pass()) {
         int x, y;
         do {
@@ -607,8 +130,17 @@ unsigned long total_num_games = 0;
 unsigned long total_num_rounds = 0;
 unsigned long total_num_steps = 0;
 
-/* The trees used in MCTS. They are pairs of (state, score) */
-unordered_map<Position, value *> trees[2];
+/* The most memory taken by the trees of the process at once, in bytes: the
+   ones of a move, and the ones the other player kept from its last move */
+unsigned long peak_tree_bytes = 0;
+unsigned long player_tree_bytes[2] = {0, 0};
+
+/* The clocks of the players at the end of the game, see TIME_MANAGER */
+double main_time_left[2] = {0, 0};
+int moves_over_time = 0;
+
+/* The seed of the simulations; every thread draws from its own generator */
+uint64_t random_seed = 0;
 
 /**
  * This is MCTS play.
@@ -617,8 +149,19 @@ unordered_map<Position, value *> trees[2];
  * @param playout_num The number of simulations in MCTS.
  * @returns A new state after choosing a move.
  */
-Position *mcts_play(Position *s, float iters, float playout_num, unordered_map<Position, value *> &tree) {
+template <int N>
+Position<N> *mcts_play(Position<N> *s, float iters, float playout_num, Tree &tree) {
+    // The player whose wins the scores of the tree count
+#if ONE_TREE
+    int my_player = 1;
+#else
     int my_player = s->player;
+#endif
+    int root_color = s->player == 1 ? 0 : 1;  // As in Position::stones, for AMAF
+#if EARLY_STOP
+    bool maximize = s->player == my_player;  // For decided_move
+    double played = 0;  // The games of this search
+#endif
 
     // The player cannot put a stone. Pass move!
     if (s->is_pass()) {
@@ -626,29 +169,20 @@ Position *mcts_play(Position *s, float iters, float playout_num, unordered_map<P
         return s;
     }
 
-    // If 's' (current state) is not in the tree, create the state
-    if (tree.find(*s) == tree.end()) {
-        // Create a linked-list for game scores
-        tree[*s] = new value(NULL, 0, 0);
-
-        // Get the available moves
-        vector<Position> next_pos;
-        get_next_pos(s, next_pos);
-
-        // For every move, check if the state exists in the tree then update 
-        // the scores for current state
-        value *v = tree[*s];
-        for (int i = 0; i < next_pos.size(); ++i) {
-            if (tree.find(next_pos[i]) != tree.end()) {
-                v->total_game += tree[next_pos[i]]->total_game;
-                v->total_win += tree[next_pos[i]]->total_win;
-            }
-        }
-    }
-
-    bool all_in;
-    value *root_v = tree[*s];
-    Position *t;
+    // The tree of this search, rooted at the current state: what the tree of
+    // the previous move collected under it, else an empty tree
+    int root_moves[Position<N>::POINTS];
+    int root_move_num = get_next_moves(s, root_moves);
+    tree.advance(s->key, root_moves, root_move_num);
+
+    Position<N> &t = *s;  // Walks down the tree and back up
+    // Reused by every move, so the search allocates nothing once they have
+    // grown to the longest path
+    static vector<Undo> path;  // The moves that t made from the root
+    static Path visited;  // The edges of the tree it followed
+    static Random rng(random_seed);
+    static Playout<N> playout;  // Reused by every simulation
+    static Amaf amaf;  // The moves of its games, for RAVE
     
     // Run the game 'iters' times
 #if USE_TIME_ROUND
@@ -658,92 +192,42 @@ Position *mcts_play(Position *s, float iters, float playout_num, unordered_map<P
 #else
     for (int i = 0; i < iters; ++i) {
 #endif        
-        t = s;
         total_num_rounds++;
 
-        // Selection
-        while (!t->game_over()) {
-            all_in = true; // all child nodes are expanded
-
-            // Get next moves
-            vector<Position> next_pos;
-            get_next_pos(t, next_pos);
-
-            // Search the first move from that is not in the existing tree.
-            // Also, if one move not found, set all_in to false
-            int index = 0;
-            for (int j = 0; j < next_pos.size(); ++j) {
-                if (tree.find(next_pos[j]) == tree.end()) {
-                    all_in = false;
-                    index = j;
-                    break;
-                }
+        // Selection, down to a node that is not in the tree yet (or to the
+        // longest path, around a cycle of repeated positions)
+        uint32_t node = tree.root();
+        while (!t.game_over() && !visited.full()) {
+            // List the moves the first time the node is reached
+            if (!tree.expanded(node)) {
+                int moves[Position<N>::POINTS];
+                int move_num = get_next_moves(&t, moves);
+                if (!tree.expand(node, moves, move_num))
+                    break;  // The tree is full: simulate from here
             }
 
-            // If all_in then tree policy else expand (create a new node) and break
-            if (all_in == false) {
-                // Explore new state
-                tree[next_pos[index]] = new value(tree[*t], 0.0, 0.0);
-                t = new Position(next_pos[index]);
-                break;
-            } else {
-                // All child nodes are visited. Find the best current children,
-                // UCTS strategy
-                double z = 0.2;
-                value *v = tree[*t];
-                double T = v->total_game;
-                Position *tmp_pos = NULL;
-                int best_row, best_col;
-
-                // Select next child
-                if (t->player == my_player) {
-                    // For my_player, select the child that maximizes the score
-                    double ucb = -10000000000000.0;
-                    for (int j = 0; j < next_pos.size(); ++j) {
-                        value *vv = tree[next_pos[j]];
-                        double pj = vv->total_win;
-                        double nj = vv->total_game;
-                        double tmp_ucb = pj / nj + sqrt(z * log(T) / nj);
-	
-                        if (ucb < tmp_ucb) {
-                            ucb = tmp_ucb;
-                            tmp_pos = &next_pos[j];
-                        }
-                    }
-                } else {
-                    // For the other player, select the child that minimizes the score
-                    double ucb = 10000000000000.0;
-                    for (int j = 0; j < next_pos.size(); ++j) {
-                        value *vv = tree[next_pos[j]];
-                        double pj = vv->total_win;
-                        double nj = vv->total_game;
-                        double tmp_ucb = pj / nj - sqrt(z * log(T) / nj);
-	
-                        if (ucb > tmp_ucb) {
-                            ucb = tmp_ucb;
-                            tmp_pos = &next_pos[j];
-                        }
-                    }
-                }
+            // The best open move by UCB (FPU for the ones never tried)
+            uint32_t e = tree.select(node, t.player == my_player);
+            visited.push_back(e);
+            path.push_back(Undo());
+            play_move(&t, tree.edges.move[e], &path.back());
 
-                // Add to linked-list, the parent value
-                tree[*tmp_pos]->last_pos_value = v;
-                if (t != s)
-                    delete t;
- 
-                // Go to next state
-                t = new Position(*tmp_pos);
+            if (tree.edges.child[e] == Tree::NONE) {
+                // Explore new state (or join its node when it is in the tree)
+                tree.add_child(e, t.key, visited);
+                break;
             }
+            node = tree.edges.child[e];
         }
 
         // Playout policy: Run some random games and obtain some scores
         double total_g = 0, total_w = 0;
-        if (t->game_over()) {
+        if (t.game_over()) {
             // 't' is a final state, just update the scores
-            if (t->who_win() == my_player) {
+            if (t.who_win() == my_player) {
                 total_g = playout_num;
                 total_w = playout_num;
-            } else if (t->who_win() == 0) {
+            } else if (t.who_win() == 0) {
                 total_g = playout_num;
                 total_w = playout_num / 2.0;
             } else {
@@ -759,56 +243,22 @@ Position *mcts_play(Position *s, float iters, float playout_num, unordered_map<P
 #else
                 for (int j = 0; j < playout_num; ++j) {
 #endif
-                Position *tt = new Position(*t);
                 // Run a random simulation
-                int steps = 0;
                 total_num_games++;
-
-                while (!tt->game_over()) {
-                    total_num_steps++;
-                    steps++;
-                    if (!tt->is_pass()) {
-                        int x = 0, y = 0;
-#if RANDOM_PLAY
-                        do {
-                            x = rand() % 9;
-                            y = rand() % 9;
-                        } while (tt->make_move(x, y) == -1);
-#else
-                        do {
-                            x++;
-                            if (x == 9) {
-                                x = 0;
-                                y++;
-                            }
-                            y %= 9;
-                        } while (tt->make_move(x, y) == -1);
-#endif
-                    } else {
-                        tt->pass_move();
-                    }
-
-                    if (steps == 5000) {
-#if VISUAL
-                        cout << "STUKED!" << endl;
-                        tt->print();
-#endif
-                        break;
-                    }
-                }
+                int winner = playout.run(t, rng, &total_num_steps);
 
                 // Update the scores based on the result of the last game
-                if (tt->who_win() == my_player) {
+                if (winner == my_player) {
                     total_g += 1;
                     total_w += 1;
-                } else if (tt->who_win() == 0) {
+                } else if (winner == 0) {
                     total_g += 1;
                     total_w += 0.5;
                 } else {
                     total_g += 1;
                     total_w += 0;
                 }
-                delete tt;
+                amaf.add_game(playout, winner == my_player ? 1 : winner == 0 ? 0.5 : 0);
 #if USE_TIME_SIM
                     timing(&time2_sim, &time_cpu);
                 } while (time2_sim - time1_sim < playout_num);
@@ -817,58 +267,142 @@ Position *mcts_play(Position *s, float iters, float playout_num, unordered_map<P
 #endif        
         }
 
-        // Back propagate the result (up to 500 levels of the tree)
-        value *v_ = tree[*t];
-        v_->total_game += total_g;
-        v_->total_win += total_w;
-        int loop_num = 0;
+        // Back propagate the result
+        tree.update(visited, total_g, total_w);
+        tree.update_amaf(visited, root_color, amaf, total_g, total_w);
+        amaf.clear();
+        visited.clear();
 
-        while (v_ != root_v && loop_num++ < 500) {
-            v_ = v_->last_pos_value;
-            v_->total_game += total_g;
-            v_->total_win += total_w;
+        // Stay within the memory budget of the tree
+        if (tree.full())
+            tree.prune();
+
+        // Go back up to the root
+        while (!path.empty()) {
+            t.unmake_move(path.back());
+            path.pop_back();
         }
-        delete t;
 
 #if USE_TIME_ROUND
         timing(&time2_round, &time_cpu);
+#endif
+#if EARLY_STOP
+        // Stop once the games left cannot change the move chosen
+        played += total_g;
+#if USE_TIME_ROUND
+        double done = (time2_round - time1_round) / iters;
+#else
+        double done = (i + 1.0) / iters;
+#endif
+        if (tree.decided(played, done, maximize) >= 0)
+            break;
+#endif
+
+#if USE_TIME_ROUND
     } while (time2_round - time1_round < iters);
 #else
     }
 #endif
 
+    // The memory of the trees of the move
+    unsigned long tree_bytes = tree.bytes();
+    player_tree_bytes[ONE_TREE || my_player == 1 ? 0 : 1] = tree_bytes;
+    if (peak_tree_bytes < player_tree_bytes[0] + player_tree_bytes[1])
+        peak_tree_bytes = player_tree_bytes[0] + player_tree_bytes[1];
+#if LOG_TREE
+    cout << "Tree memory (MB): " << tree_bytes / 1048576.0 << endl;
+#endif
+
     // Choose the best move
-    vector<Position> next_pos;
-    get_next_pos(s, next_pos);
-    double average = -10.0;
-    int index = -1;
-
-    for (int i = 0; i < next_pos.size(); ++i) {
-        if (tree.find(next_pos[i]) != tree.end()) {
-            value *v = tree[next_pos[i]];
-            if (average < v->total_win / v->total_game) {
-                average = v->total_win / v->total_game;
-                index = i;
-            }
-        }
+    play_move(s, tree.best_move(s->player == my_player), NULL);
+    return s;
+}
+
+/**
+ * Plays a whole game on a board of size N, MCTS against MCTS.
+ * @param iteration The time (or number of iterations) of one move, or the
+ * main time of each player for the game (TIME_MANAGER).
+ * @param playout_num The time (or number of games) of one simulation phase.
+ * @returns The number of rounds played.
+ */
+template <int N>
+int play_game(float iteration, float playout_num) {
+    // The trees used in MCTS, one per player (or the first one for both, see
+    // ONE_TREE): the ones searched share the memory budget of the process
+    Tree trees[2];
+    int tree_num = ONE_TREE ? 1 : 2;
+    for (int i = 0; i < tree_num; ++i)
+        trees[i].set_budget(tree_budget(tree_num));
+    Position<N> *s = new Position<N>();
+#if TIME_MANAGER
+    // The clocks of the players: iteration is the main time of each one, and
+    // then the time of every move
+    TimeManager clocks[2] = {TimeManager(iteration, BYO_YOMI), TimeManager(iteration, BYO_YOMI)};
+#endif
+    int round_num = 0;
+
+    while (!s->game_over()) {
+#if VISUAL
+        cout << endl
+             << "========= Round: " << round_num << " ==========" << endl;
+        cout << "========== Player 1 ==========" << endl;
+#endif
+#if TIME_MANAGER
+        iteration = clocks[0].start_move(*s);
+#endif
+        s = mcts_play(s, iteration, playout_num, trees[0]);
+#if TIME_MANAGER
+        clocks[0].end_move(trees[0], true);
+#endif
+
+#if VISUAL
+        s->print();
+#endif
+        round_num += 1;
+        if (s->game_over())
+            break;
+
+#if VISUAL
+        cout << "========== Player 2 ==========" << endl;
+#endif
+#if TIME_MANAGER
+        iteration = clocks[1].start_move(*s);
+#endif
+        s = mcts_play(s, iteration, playout_num, trees[ONE_TREE ? 0 : 1]);
+#if TIME_MANAGER
+        clocks[1].end_move(trees[ONE_TREE ? 0 : 1], !ONE_TREE);
+#endif
+
+#if VISUAL
+        s->print();
+#endif
+    }
+
+#if TIME_MANAGER
+    for (int i = 0; i < 2; ++i) {
+        main_time_left[i] = clocks[i].main_left();
+        moves_over_time += clocks[i].over_time();
     }
+#endif
 
+    // Release memory
     delete s;
-    s = new Position(next_pos[index]);
-    return s;
+
+    return round_num;
 }
 
 int main(int argc, char **argv) {
     srand(time(0));
+    random_seed = time(0);
 
-    Position *s = new Position();
     double times1[2];
     double times2[2];
     int round_num = 0;
     float playout_num, iteration;
+    int board_size = DEFAULT_BOARD_SIZE;
 
-    if (argc != 3) {
-        cout << "usage: iteration/time_round> <playout_num/time_sim" << endl;
+    if (argc != 3 && argc != 4) {
+        cout << "usage: <iteration/time_round> <playout_num/time_sim> [board_size: 9, 13, 19]" << endl;
         return 0;
     }
 
@@ -884,33 +418,27 @@ int main(int argc, char **argv) {
     playout_num = atoi(argv[2]);
 #endif
 
+    if (argc == 4)
+        board_size = atoi(argv[3]);
+    if (board_size != 9 && board_size != 13 && board_size != 19) {
+        cout << "The board size must be 9, 13 or 19" << endl;
+        return 0;
+    }
+
 #if LOG
     timing(times1, times1 + 1);
 #endif
 
-    while (!s->game_over()) {
-#if VISUAL
-        cout << endl
-             << "========= Round: " << round_num << " ==========" << endl;
-        cout << "========== Player 1 ==========" << endl;
-#endif
-        s = mcts_play(s, iteration, playout_num, trees[0]);
-
-#if VISUAL
-        s->print();
-#endif
-        round_num += 1;
-        if (s->game_over())
-            break;
-
-#if VISUAL
-        cout << "========== Player 2 ==========" << endl;
-#endif
-        s = mcts_play(s, iteration, playout_num, trees[1]);
-
-#if VISUAL
-        s->print();
-#endif
+    switch (board_size) {
+    case 9:
+        round_num = play_game<9>(iteration, playout_num);
+        break;
+    case 13:
+        round_num = play_game<13>(iteration, playout_num);
+        break;
+    case 19:
+        round_num = play_game<19>(iteration, playout_num);
+        break;
     }
 
 #if LOG
@@ -921,20 +449,16 @@ int main(int argc, char **argv) {
     cout << "Total number of simulated games: " << total_num_games << " " << endl;
     cout << "Total number of simulated rounds: " << total_num_rounds << " " << endl;
     cout << "Total number of simulated steps: " << total_num_steps << " " << endl;
+    cout << "Peak tree memory (MB): " << peak_tree_bytes / 1048576.0 << " of " << PROCESS_MAX_MB << endl;
+#if TIME_MANAGER
+    cout << "Main time left (seconds): " << main_time_left[0] << " " << main_time_left[1] << endl;
+    cout << "Moves over the time: " << moves_over_time << endl;
+#endif
     cout << endl;
     cout << "Total time (seconds): " << times2[0] - times1[0] << endl;
     cout << "Average time for one round (seconds): " << (times2[0] - times1[0]) / round_num << endl;
     cout << endl;
 #endif
 
-    // Release memory
-    delete s;
-    for (auto tree : trees) {
-       for (auto it = tree.begin(); it != tree.end();) {
-            delete it->second;
-            it = tree.erase(it);
-        }
-    }
-
     return 0;
 }
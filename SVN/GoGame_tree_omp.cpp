@@ -0,0 +1,480 @@
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <vector>
+#include <omp.h>
+
+#include "GoGame_mcts.h"
+#include "GoGame_playout.h"
+
+using namespace std;
+
+#define VISUAL              0   // For visualizing the game
+#define LOG                 1   // For printing the average time
+#define LOG_TREE            1   // For printing the memory of the trees at every move
+
+#define USE_TIME_ROUND      1   // 1 = Use time; 0 = Use iterations
+#define TIME_PER_ROUND      0.5   // In seconds
+#define TIME_MANAGER        0   // 1 = time_round is the main time of each player for the game (TimeManager)
+#define BYO_YOMI            0.0 // ... then the time of every move (0 = sudden death)
+
+#define USE_TIME_SIM        1   // 1 = Use time; 0 = Use iterations
+#define TIME_PER_SIM        0.05 // In seconds
+#define EARLY_STOP          0   // 1 = A search stops once the games left cannot change its move
+
+
+/**
+ * Measures the time.
+ * @param wcTime The time measured on world clock
+ * @param cpuTime The time measured on CPU
+ */
+void timing(double *wcTime, double *cpuTime) {
+    struct timeval tp;
+    struct rusage ruse;
+
+    gettimeofday(&tp, NULL);
+    *wcTime = (double)(tp.tv_sec + tp.tv_usec / 1000000.0);
+
+    getrusage(RUSAGE_SELF, &ruse);
+    *cpuTime = (double)(ruse.ru_utime.tv_sec + ruse.ru_utime.tv_usec / 1000000.0);
+}
+
+/**
+ * Lists the moves from current state: the pass when the player cannot put a
+ * stone, else every legal point, the ones far from the edge first.
+ * @param s Current state.
+ * @param moves The points where to put a stone (-1 for the pass), returned by
+ * side effect.
+ * @returns The number of moves.
+ */
+template <int N>
+int get_next_moves(Position<N> *s, int *moves) {
+    // If pass move, then the next move is only the "pass move"
+    if (s->is_pass()) {
+        moves[0] = -1;
+        return 1;
+    }
+
+    // The points from the 4th line inwards first, then the 3rd, 2nd and 1st
+    // lines: a cheap prior, as the selection opens the first moves of a node
+    // first until they have AMAF scores (see Tree::prior)
+    static const Bitboard<N> rings[3] = {inner_points<N>(3), inner_points<N>(2), inner_points<N>(1)};
+
+    int move_num = 0;
+    Bitboard<N> legal = s->legal_moves();
+    for (int i = 0; i <= 3; ++i) {
+        Bitboard<N> ring = i < 3 ? legal & rings[i] : legal;
+        legal = legal - ring;
+        while (ring.any()) {
+            int p = ring.first();
+            ring.reset(p);
+            moves[move_num++] = p;
+        }
+    }
+    return move_num;
+}
+
+/**
+ * Plays a move given by get_next_moves.
+ * @param s The current state.
+ * @param move The point where to put the stone, -1 for the pass.
+ * @param undo When given, records the move to take it back.
+ */
+template <int N>
+void play_move(Position<N> *s, int move, Undo *undo) {
+    if (move == -1)
+        s->pass_move(undo);
+    else
+        s->play(move, undo);
+}
+
+/**
+ * This is a random player.
+ * @param s The current state.
+ */
+template <int N>
+void random_play(Position<N> *s) {
+    if (!s->is_pass()) {
+        Bitboard<N> moves = s->legal_moves();
+        int p = moves.nth(rand() % moves.count());
+        s->make_move(Position<N>::row(p), Position<N>::col(p));
+    } else {
+        s->pass_move();
+    }
+}
+
+/**
+ * This is for manual play (playing against a human).
+ * @param s The current state.
+ */
+template <int N>
+void manual_play(Position<N> *s) {
+    if (!s->is_pass()) {
+        int x, y;
+        do {
+            cin >> x >> y;
+        } while (s->make_move(x, y) == -1);
+    } else {
+        s->pass_move();
+    }
+}
+
+/* Total number of games, rounds and steps played */
+unsigned long total_num_games = 0;
+unsigned long total_num_rounds = 0;
+unsigned long total_num_steps = 0;
+
+/* Total number of nodes of the trees */
+unsigned long total_num_nodes = 0;
+
+/* The most memory taken by the trees of a move, in bytes */
+unsigned long peak_tree_bytes = 0;
+
+/* The clocks of the players at the end of the game, see TIME_MANAGER */
+double main_time_left[2] = {0, 0};
+int moves_over_time = 0;
+
+/* The seed of the simulations; every thread draws from its own generator */
+uint64_t random_seed = 0;
+
+/**
+ * This is MCTS play, all the threads searching the same tree.
+ * @param s The current state.
+ * @param iters The number of games played for simulation phase.
+ * @param playout_num The number of simulations in MCTS.
+ * @param tree The tree shared by the threads.
+ * @returns A new state after choosing a move.
+ */
+template <int N>
+Position<N> *mcts_play(Position<N> *s, float iters, float playout_num, SharedTree &tree) {
+    int my_player = s->player;
+
+    // The player cannot put a stone. Pass move!
+    if (s->is_pass()) {
+        s->pass_move();
+        return s;
+    }
+
+    // The tree of this search, rooted at the current state
+    tree.clear();
+#if EARLY_STOP
+    std::atomic<bool> decided(false);  // The threads stop once the first one decides the move
+#endif
+
+    #pragma omp parallel  \
+        reduction(+: total_num_games) \
+        reduction(+: total_num_rounds) \
+        reduction(+: total_num_steps)
+    {
+        int threadIndex = omp_get_thread_num();
+
+        // Owned by the thread and reused by every move, so the search allocates
+        // nothing once they have grown to the longest path
+        static thread_local Position<N> t;  // Walks down the tree and back up
+        static thread_local vector<Undo> path;  // The moves that t made from the root
+        static thread_local Path visited;  // The edges of the tree it followed
+        t = *s;
+        static thread_local Random rng(random_seed, threadIndex);
+        static thread_local Playout<N> playout;  // Reused by every simulation
+
+        // Run the game 'iters' times
+#if USE_TIME_ROUND
+        double time1_round, time2_round, time_cpu;
+        timing(&time1_round, &time_cpu);
+        do {
+#else
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < (int)iters; ++i) {
+#if EARLY_STOP
+            // The loop is shared out, so it skips the rounds left instead
+            if (decided.load(std::memory_order_relaxed))
+                continue;
+#endif
+#endif
+            total_num_rounds++;
+
+            // Selection, down to a node that is not in the tree yet (or to the
+            // longest path)
+            uint32_t node = tree.root();
+            while (!t.game_over() && !visited.full()) {
+                // List the moves the first time the node is reached
+                if (!tree.expanded(node)) {
+                    int moves[Position<N>::POINTS];
+                    int move_num = get_next_moves(&t, moves);
+                    if (!tree.expand(node, moves, move_num))
+                        break;  // Another thread lists them, or the tree is full
+                }
+
+                // The first move not tried yet, else the best child by UCB
+                // (with the virtual losses of the other threads)
+                uint32_t e = tree.select(node, t.player == my_player);
+                visited.push_back(e);
+                path.push_back(Undo());
+                play_move(&t, tree.edges[e].move, &path.back());
+
+                uint32_t child = tree.edges[e].child.load(std::memory_order_acquire);
+                if (child == SharedTree::NONE) {
+                    // Explore new state
+                    tree.add_child(e);
+                    break;
+                }
+                node = child;
+            }
+
+            // Playout policy: Run some random games and obtain some scores
+            double total_g = 0, total_w = 0;
+            if (t.game_over()) {
+                // 't' is a final state, just update the scores
+                if (t.who_win() == my_player) {
+                    total_g = playout_num;
+                    total_w = playout_num;
+                } else if (t.who_win() == 0) {
+                    total_g = playout_num;
+                    total_w = playout_num / 2.0;
+                } else {
+                    total_g = playout_num;
+                    total_w = 0;
+                }
+            } else {
+                // Run simulations 'playout_num' times
+#if USE_TIME_SIM
+                double time1_sim, time2_sim, time_cpu;
+                timing(&time1_sim, &time_cpu);
+                do {
+#else
+                for (int j = 0; j < playout_num; ++j) {
+#endif
+                    // Run a random simulation
+                    total_num_games++;
+                    int winner = playout.run(t, rng, &total_num_steps);
+
+                    // Update the scores based on the result of the last game
+                    if (winner == my_player) {
+                        total_g += 1;
+                        total_w += 1;
+                    } else if (winner == 0) {
+                        total_g += 1;
+                        total_w += 0.5;
+                    } else {
+                        total_g += 1;
+                        total_w += 0;
+                    }
+#if USE_TIME_SIM
+                    timing(&time2_sim, &time_cpu);
+                } while (time2_sim - time1_sim < playout_num);
+#else
+                }
+#endif
+            }
+ 
+            // Back propagate the result
+            tree.update(visited, total_g, total_w);
+            visited.clear();
+
+            // Go back up to the root
+            while (!path.empty()) {
+                t.unmake_move(path.back());
+                path.pop_back();
+            }
+
+#if USE_TIME_ROUND
+            timing(&time2_round, &time_cpu);
+#endif
+#if EARLY_STOP
+            // The first thread checks the tree, all the games of the search
+            // at its root, once the games left cannot change the move (the
+            // other threads may each have a virtual loss on one of its moves)
+            if (threadIndex == 0) {
+                float scores[2 * Position<N>::POINTS];
+                int move_num = tree.root_scores(scores);
+                double played = 0;
+                for (int j = 0; j < move_num; ++j)
+                    played += scores[2 * j];
+#if USE_TIME_ROUND
+                double done = (time2_round - time1_round) / iters;
+#else
+                double done = (i + 1.0) / iters;
+#endif
+                if (tree.decided(played, done, true, omp_get_num_threads() * VIRTUAL_LOSS) >= 0)
+                    decided.store(true, std::memory_order_relaxed);
+            }
+#if USE_TIME_ROUND
+            if (decided.load(std::memory_order_relaxed))
+                break;
+#endif
+#endif
+
+#if USE_TIME_ROUND
+        } while (time2_round - time1_round < iters);
+#else
+        }
+#endif
+    }
+
+    // The size of the tree of the move
+    total_num_nodes += tree.size();
+    unsigned long tree_bytes = tree.bytes();
+    if (peak_tree_bytes < tree_bytes)
+        peak_tree_bytes = tree_bytes;
+#if LOG_TREE
+    cout << "Tree memory (MB): " << tree_bytes / 1048576.0 << endl;
+#endif
+
+    // Choose the best move
+    play_move(s, tree.best_move(), NULL);
+    return s;
+}
+
+/**
+ * Plays a whole game on a board of size N, MCTS against MCTS.
+ * @param iteration The time (or number of iterations) of one move, or the
+ * main time of each player for the game (TIME_MANAGER).
+ * @param playout_num The time (or number of games) of one simulation phase.
+ * @returns The number of rounds played.
+ */
+template <int N>
+int play_game(float iteration, float playout_num) {
+    // The tree used in MCTS, by both players in turn
+    SharedTree *tree = new SharedTree();
+    Position<N> *s = new Position<N>();
+#if TIME_MANAGER
+    // The clocks of the players: iteration is the main time of each one, and
+    // then the time of every move
+    TimeManager clocks[2] = {TimeManager(iteration, BYO_YOMI), TimeManager(iteration, BYO_YOMI)};
+#endif
+    int round_num = 0;
+
+    while (!s->game_over()) {
+#if VISUAL
+        cout << endl
+             << "========= Round: " << round_num << " ==========" << endl;
+        cout << "========== Player 1 ==========" << endl;
+#endif
+#if TIME_MANAGER
+        iteration = clocks[0].start_move(*s);
+#endif
+        s = mcts_play(s, iteration, playout_num, *tree);
+#if TIME_MANAGER
+        clocks[0].end_move(*tree, true);
+#endif
+
+#if VISUAL
+        s->print();
+#endif
+        round_num += 1;
+        if (s->game_over())
+            break;
+
+#if VISUAL
+        cout << "========== Player 2 ==========" << endl;
+#endif
+#if TIME_MANAGER
+        iteration = clocks[1].start_move(*s);
+#endif
+        s = mcts_play(s, iteration, playout_num, *tree);
+#if TIME_MANAGER
+        clocks[1].end_move(*tree, true);
+#endif
+
+#if VISUAL
+        s->print();
+#endif
+    }
+
+#if TIME_MANAGER
+    for (int i = 0; i < 2; ++i) {
+        main_time_left[i] = clocks[i].main_left();
+        moves_over_time += clocks[i].over_time();
+    }
+#endif
+
+    // Release memory
+    delete tree;
+    delete s;
+
+    return round_num;
+}
+
+int main(int argc, char **argv) {
+    srand(time(0));
+    random_seed = time(0);
+
+    double times1[2];
+    double times2[2];
+    int round_num = 0;
+    int thread_num;
+    float playout_num, iteration;
+    int board_size = DEFAULT_BOARD_SIZE;
+
+    if (argc != 4 && argc != 5) {
+        cout << "usage: <iteration/time_round> <playout_num/time_sim> <num_threads> [board_size: 9, 13, 19]" << endl;
+        return 0;
+    }
+
+#if USE_TIME_ROUND
+    iteration = atof(argv[1]);
+#else
+    iteration = atoi(argv[1]);
+#endif
+
+#if USE_TIME_SIM
+    playout_num = atof(argv[2]);
+#else
+    playout_num = atoi(argv[2]);
+#endif
+
+    thread_num = atoi(argv[3]);
+    omp_set_num_threads(thread_num);
+
+    if (argc == 5)
+        board_size = atoi(argv[4]);
+    if (board_size != 9 && board_size != 13 && board_size != 19) {
+        cout << "The board size must be 9, 13 or 19" << endl;
+        return 0;
+    }
+
+#if LOG
+    timing(times1, times1 + 1);
+#endif
+
+    switch (board_size) {
+    case 9:
+        round_num = play_game<9>(iteration, playout_num);
+        break;
+    case 13:
+        round_num = play_game<13>(iteration, playout_num);
+        break;
+    case 19:
+        round_num = play_game<19>(iteration, playout_num);
+        break;
+    }
+
+#if LOG
+    timing(times2, times2 + 1);
+
+    cout << endl << "==== Game finished ====" << endl;
+    cout << "Number of rounds played: " << round_num << endl;
+    cout << "Total number of simulated games: " << total_num_games << " " << endl;
+    cout << "Total number of simulated rounds: " << total_num_rounds << " " << endl;
+    cout << "Total number of simulated steps: " << total_num_steps << " " << endl;
+    cout << "Total number of tree nodes: " << total_num_nodes << " " << endl;
+    cout << "Peak tree memory (MB): " << peak_tree_bytes / 1048576.0 << " of " << PROCESS_MAX_MB << endl;
+#if TIME_MANAGER
+    cout << "Main time left (seconds): " << main_time_left[0] << " " << main_time_left[1] << endl;
+    cout << "Moves over the time: " << moves_over_time << endl;
+#endif
+    cout << endl;
+    cout << "Total time (seconds): " << times2[0] - times1[0] << endl;
+    cout << "Tree nodes per second: " << total_num_nodes / (times2[0] - times1[0]) << endl;
+    cout << "Simulated games per second: " << total_num_games / (times2[0] - times1[0]) << endl;
+    cout << "Average time for one round (seconds): " << (times2[0] - times1[0]) / round_num << endl;
+    cout << endl;
+#endif
+
+    return 0;
+}
@@ -22,4 +22,13 @@ elif [ $RUN_MODE = "MPI" ]; then
 elif [ $RUN_MODE = "HYBRID" ]; then
 	echo "Running HYBRID"
 	make run_hybrid
+elif [ $RUN_MODE = "TREE_OMP" ]; then
+	echo "Running TREE OMP"
+	make run_tree_omp
+elif [ $RUN_MODE = "LEAF_PTHREAD" ]; then
+	echo "Running LEAF PTHREADS"
+	make run_leaf_lpthreads
+elif [ $RUN_MODE = "MATCH" ]; then
+	echo "Running MATCH"
+	make run_match TIME_SIM=$TIME_SIM TIME_PLAY=$TIME_PLAY
 fi